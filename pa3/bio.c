@@ -22,6 +22,7 @@
 #include "defs.h"
 #include "param.h"
 #include "spinlock.h"
+#include "waitq.h"
 #include "sleeplock.h"
 #include "fs.h"
 #include "buf.h"
@@ -29,6 +30,7 @@
 struct {
   struct spinlock lock;
   struct buf buf[NBUF];
+  int nahead;  // read-aheads in flight
 
   // Linked list of all buffers, through prev/next.
   // head.next is most recently used.
@@ -50,6 +52,7 @@ binit(void)
     b->next = bcache.head.next;
     b->prev = &bcache.head;
     initsleeplock(&b->lock, "buffer");
+    initwaitq(&b->wait);
     bcache.head.next->prev = b;
     bcache.head.next = b;
   }
@@ -115,17 +118,75 @@ bwrite(struct buf *b)
   iderw(b);
 }
 
-// Release a locked buffer.
-// Move to the head of the MRU list.
-void
-brelse(struct buf *b)
+// Return a locked buf with the contents of the indicated
+// block if it is cached, or 0 rather than read the disk.
+struct buf*
+bcached(uint dev, uint blockno)
 {
-  if(!holdingsleep(&b->lock))
-    panic("brelse");
+  struct buf *b;
 
-  releasesleep(&b->lock);
+  acquire(&bcache.lock);
+  for(b = bcache.head.next; b != &bcache.head; b = b->next){
+    if(b->dev == dev && b->blockno == blockno && (b->flags & B_VALID)){
+      b->refcnt++;
+      release(&bcache.lock);
+      acquiresleep(&b->lock);
+      return b;
+    }
+  }
+  release(&bcache.lock);
+  return 0;
+}
+
+// Start reading the indicated block into the cache and
+// return without waiting.  Does nothing if the block is
+// already cached, or if a quarter of the buffers are
+// already busy with read-aheads.
+void
+breadahead(uint dev, uint blockno)
+{
+  struct buf *b;
 
   acquire(&bcache.lock);
+  if(bcache.nahead >= NBUF/4){
+    release(&bcache.lock);
+    return;
+  }
+  for(b = bcache.head.next; b != &bcache.head; b = b->next){
+    if(b->dev == dev && b->blockno == blockno){
+      release(&bcache.lock);
+      return;
+    }
+  }
+  for(b = bcache.head.prev; b != &bcache.head; b = b->prev){
+    if(b->refcnt == 0 && (b->flags & B_DIRTY) == 0) {
+      b->dev = dev;
+      b->blockno = blockno;
+      b->flags = 0;
+      b->refcnt = 1;
+      release(&bcache.lock);
+      acquiresleep(&b->lock);
+      // A bread() may have found b and read it first.
+      if(b->flags & B_VALID){
+        brelse(b);
+        return;
+      }
+      acquire(&bcache.lock);
+      bcache.nahead++;
+      release(&bcache.lock);
+      b->flags |= B_ASYNC;
+      ideasync(b);
+      return;
+    }
+  }
+  release(&bcache.lock);
+}
+
+// Drop a reference to b; if it was the last, move b
+// to the head of the MRU list.  Caller holds bcache.lock.
+static void
+bunref(struct buf *b)
+{
   b->refcnt--;
   if (b->refcnt == 0) {
     // no one is waiting for it.
@@ -136,7 +197,34 @@ brelse(struct buf *b)
     bcache.head.next->prev = b;
     bcache.head.next = b;
   }
-  
+}
+
+// Release a locked buffer.
+// Move to the head of the MRU list.
+void
+brelse(struct buf *b)
+{
+  if(!holdingsleep(&b->lock))
+    panic("brelse");
+
+  releasesleep(&b->lock);
+
+  acquire(&bcache.lock);
+  bunref(b);
+  release(&bcache.lock);
+}
+
+// Release a breadahead() buffer once its read is done.
+// Called by ideintr, on behalf of no process.
+void
+bdone(struct buf *b)
+{
+  b->flags &= ~B_ASYNC;
+  releasesleep(&b->lock);
+
+  acquire(&bcache.lock);
+  bcache.nahead--;
+  bunref(b);
   release(&bcache.lock);
 }
 //PAGEBREAK!
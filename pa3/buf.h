@@ -3,6 +3,7 @@ struct buf {
   uint dev;
   uint blockno;
   struct sleeplock lock;
+  struct waitq wait; // processes waiting for disk I/O
   uint refcnt;
   struct buf *prev; // LRU cache list
   struct buf *next;
@@ -11,4 +12,5 @@ struct buf {
 };
 #define B_VALID 0x2  // buffer has been read from disk
 #define B_DIRTY 0x4  // buffer needs to be written to disk
+#define B_ASYNC 0x8  // read ahead; released by ideintr, not a process
 
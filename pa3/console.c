@@ -7,11 +7,13 @@
 #include "param.h"
 #include "traps.h"
 #include "spinlock.h"
+#include "waitq.h"
 #include "sleeplock.h"
 #include "fs.h"
 #include "file.h"
 #include "memlayout.h"
 #include "mmu.h"
+#include "rbtree.h"
 #include "proc.h"
 #include "x86.h"
 
@@ -2,19 +2,28 @@ struct buf;
 struct context;
 struct file;
 struct inode;
+struct page;
 struct pipe;
 struct proc;
+struct rb_node;
+struct rb_root;
 struct rtcdate;
 struct spinlock;
 struct sleeplock;
+struct slabcache;
 struct stat;
 struct superblock;
+struct vma;
+struct waitq;
 
 // bio.c
 void            binit(void);
 struct buf*     bread(uint, uint);
 void            brelse(struct buf*);
 void            bwrite(struct buf*);
+struct buf*     bcached(uint, uint);
+void            breadahead(uint, uint);
+void            bdone(struct buf*);
 
 // console.c
 void            consoleinit(void);
@@ -29,6 +38,7 @@ int             exec(char*, char**);
 struct file*    filealloc(void);
 void            fileclose(struct file*);
 struct file*    filedup(struct file*);
+int             filewriteat(struct file*, char*, uint, int);
 void            fileinit(void);
 int             fileread(struct file*, char*, int n);
 int             filestat(struct file*, struct stat*);
@@ -50,6 +60,9 @@ int             namecmp(const char*, const char*);
 struct inode*   namei(char*);
 struct inode*   nameiparent(char*, char*);
 int             readi(struct inode*, char*, uint, uint);
+int             readicached(struct inode*, char*, uint, uint);
+void            ireadpage(struct inode*, uint, char*);
+void            ireadahead(struct inode*, uint, uint);
 void            stati(struct inode*, struct stat*);
 int             writei(struct inode*, char*, uint, uint);
 
@@ -57,6 +70,10 @@ int             writei(struct inode*, char*, uint, uint);
 void            ideinit(void);
 void            ideintr(void);
 void            iderw(struct buf*);
+void            ideasync(struct buf*);
+void            ideplug(void);
+void            ideunplug(void);
+void            iostat(uint*);
 
 // ioapic.c
 void            ioapicenable(int irq, int cpu);
@@ -66,6 +83,13 @@ void            ioapicinit(void);
 // kalloc.c
 char*           kalloc(void);
 void            kfree(char*);
+char*           kalloc_zeroed(void);
+char*           kalloc_order(int);
+void            kfree_order(char*, int);
+void            kmemstat(void);
+void            kzero(void);
+void            kref(char*);
+int             krefcount(char*);
 void            kinit1(void*, void*);
 void            kinit2(void*, void*);
 int             freememCount(void);
@@ -79,7 +103,10 @@ int             lapicid(void);
 extern volatile uint*    lapic;
 void            lapiceoi(void);
 void            lapicinit(void);
+void            lapicipi(uchar, int);
+void            lapiconeshot(uint64);
 void            lapicstartap(uchar, uint);
+extern uint     tscpertick;
 void            microdelay(int);
 
 // log.c
@@ -96,7 +123,16 @@ void            mpinit(void);
 void            picenable(int);
 void            picinit(void);
 
+// pagecache.c
+void            pcinit(void);
+struct page*    pcget(struct inode*, uint);
+struct page*    pclookup(struct inode*, uint);
+void            pcput(struct page*);
+void            pcupdate(struct inode*, char*, uint, uint);
+void            pcinval(struct inode*);
+
 // pipe.c
+void            pipeinit(void);
 int             pipealloc(struct file**, struct file**);
 void            pipeclose(struct pipe*, int);
 int             piperead(struct pipe*, char*, int);
@@ -121,13 +157,43 @@ void            userinit(void);
 int             wait(void);
 void            wakeup(void*);
 void            yield(void);
+void            initwaitq(struct waitq*);
+void            sleepq(struct waitq*, struct spinlock*);
+void            wakeupq(struct waitq*);
+int             needresched(void);
 int             getnice(int);
 int             setnice(int, int);
 void            ps(int);
 uint            mmap(uint, int, int, int, int, int);
 int             munmap(uint);
+int             msync(uint, int, int);
+int             madvise(uint, int, int);
+void            vmaflushall(struct proc*);
 int             page_fault_handler(uint, uint);
+int             getfaults(int, uint*);
 int             freemem(void);
+int             reclaim(int);
+char*           kalloc_reclaim(int);
+char*           pageloan(char*);
+int             swapins(void);
+int             swapouts(void);
+
+// swap.c
+void            swapinit(int);
+int             swapalloc(void);
+void            swapdup(uint);
+void            swapfree(uint);
+void            swapin(char*, uint);
+void            swapout(char*, uint);
+int             swapinCount(void);
+int             swapoutCount(void);
+
+// rbtree.c
+void            rb_insert(struct rb_node*, struct rb_root*);
+void            rb_erase(struct rb_node*, struct rb_root*);
+struct rb_node* rb_first(struct rb_root*);
+struct rb_node* rb_next(struct rb_node*);
+struct rb_node* rb_prev(struct rb_node*);
 
 // swtch.S
 void            swtch(struct context**, struct context*);
@@ -141,6 +207,12 @@ void            release(struct spinlock*);
 void            pushcli(void);
 void            popcli(void);
 
+// slab.c
+void            slabinit(struct slabcache*, char*, uint);
+void*           slaballoc(struct slabcache*);
+void            slabfree(struct slabcache*, void*);
+void            slabstat(void);
+
 // sleeplock.c
 void            acquiresleep(struct sleeplock*);
 void            releasesleep(struct sleeplock*);
@@ -170,6 +242,7 @@ void            timerinit(void);
 // trap.c
 void            idtinit(void);
 extern uint     ticks;
+void            timerarm(void);
 void            tvinit(void);
 extern struct spinlock tickslock;
 
@@ -188,13 +261,27 @@ char*           uva2ka(pde_t*, char*);
 int             allocuvm(pde_t*, uint, uint);
 int             deallocuvm(pde_t*, uint, uint);
 void            freevm(pde_t*);
+void            freevmdeferred(void);
 void            inituvm(pde_t*, char*, uint);
 int             loaduvm(pde_t*, char*, struct inode*, uint, uint);
 pde_t*          copyuvm(pde_t*, uint);
+pde_t*          copypage(pde_t*, uint);
+int             cowfault(pde_t*, uint);
 void            switchuvm(struct proc*);
 void            switchkvm(void);
 int             copyout(pde_t*, uint, void*, uint);
 void            clearpteu(pde_t *pgdir, char *uva);
 
+// vma.c
+void            vmainit(void);
+struct vma*     vmaalloc(void);
+void            vmafree(struct vma*);
+struct vma*     vmafind(struct proc*, uint);
+int             vmainsert(struct proc*, struct vma*);
+void            vmaremove(struct proc*, struct vma*);
+struct vma*     vmafirst(struct proc*);
+struct vma*     vmanext(struct vma*);
+void            vmafreeall(struct proc*);
+
 // number of elements in fixed-size array
 #define NELEM(x) (sizeof(x)/sizeof((x)[0]))
@@ -0,0 +1,110 @@
+// Disk I/O CPU cost benchmark.
+// Count how much work compute processes get done in a
+// fixed time, first alone and then while another process
+// keeps the disk busy.  The closer the two counts, the less
+// CPU the disk driver takes from the rest of the system.
+
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+#include "fcntl.h"
+
+#define TICKS  200  // length of each run
+#define FILESZ (64*1024)
+
+char buf[4096];
+
+// Spin until tick end, then send the loop count down fd.
+void
+compute(int fd, int end)
+{
+  uint n;
+  int x;
+
+  n = 0;
+  x = 1;
+  while(uptime() < end){
+    x = x * 1103515245 + 12345;
+    n++;
+  }
+  if(x == 0)
+    n++;
+  write(fd, &n, sizeof(n));
+}
+
+// Write and reread a file until tick end.
+void
+io(int end)
+{
+  int fd, i, kb;
+
+  kb = 0;
+  while(uptime() < end){
+    if((fd = open("dmabench.tmp", O_CREATE|O_RDWR)) < 0){
+      printf(1, "dmabench: cannot create file\n");
+      return;
+    }
+    for(i = 0; i < FILESZ; i += sizeof(buf)){
+      buf[0] = i;
+      write(fd, buf, sizeof(buf));
+    }
+    close(fd);
+    unlink("dmabench.tmp");
+    kb += FILESZ/1024;
+  }
+  printf(1, "dmabench: wrote %d KB\n", kb);
+}
+
+// Run ncompute compute processes, with a disk process if
+// busy is set, and return their total count.
+uint
+run(int ncompute, int busy)
+{
+  int i, end, p[2];
+  uint n, tot, before[2], after[2];
+
+  if(pipe(p) < 0){
+    printf(1, "dmabench: pipe failed\n");
+    exit();
+  }
+  iostat(before);
+  end = uptime() + TICKS;
+  for(i = 0; i < ncompute + busy; i++){
+    if(fork() == 0){
+      close(p[0]);
+      if(i < ncompute)
+        compute(p[1], end);
+      else
+        io(end);
+      exit();
+    }
+  }
+  close(p[1]);
+  tot = 0;
+  while(read(p[0], &n, sizeof(n)) == sizeof(n))
+    tot += n;
+  close(p[0]);
+  for(i = 0; i < ncompute + busy; i++)
+    wait();
+  iostat(after);
+  printf(1, "dmabench: %s: %d loops, %d sectors moved\n",
+         busy ? "with disk" : "alone", tot, after[1] - before[1]);
+  return tot;
+}
+
+int
+main(int argc, char *argv[])
+{
+  int ncompute;
+  uint alone, busy;
+
+  ncompute = 2;
+  if(argc > 1)
+    ncompute = atoi(argv[1]);
+  alone = run(ncompute, 0);
+  busy = run(ncompute, 1);
+  if(alone / 100 != 0)
+    printf(1, "dmabench: compute kept %d%% of its speed during I/O\n",
+           busy / (alone / 100));
+  exit();
+}
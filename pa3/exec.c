@@ -2,6 +2,7 @@
 #include "param.h"
 #include "memlayout.h"
 #include "mmu.h"
+#include "rbtree.h"
 #include "proc.h"
 #include "defs.h"
 #include "x86.h"
@@ -93,6 +94,10 @@ exec(char *path, char **argv)
       last = s+1;
   safestrcpy(curproc->name, last, sizeof(curproc->name));
 
+  // Write back shared mappings before they go.
+  curproc->vmbusy++;
+  vmaflushall(curproc);
+
   // Commit to the user image.
   oldpgdir = curproc->pgdir;
   curproc->pgdir = pgdir;
@@ -101,6 +106,8 @@ exec(char *path, char **argv)
   curproc->tf->esp = sp;
   switchuvm(curproc);
   freevm(oldpgdir);
+  vmafreeall(curproc);
+  curproc->vmbusy--;
   return 0;
 
  bad:
@@ -7,19 +7,22 @@
 #include "param.h"
 #include "fs.h"
 #include "spinlock.h"
+#include "slab.h"
+#include "waitq.h"
 #include "sleeplock.h"
 #include "file.h"
 
 struct devsw devsw[NDEV];
 struct {
-  struct spinlock lock;
-  struct file file[NFILE];
+  struct spinlock lock;        // protects ref counts
+  struct slabcache cache;
 } ftable;
 
 void
 fileinit(void)
 {
   initlock(&ftable.lock, "ftable");
+  slabinit(&ftable.cache, "file", sizeof(struct file));
 }
 
 // Allocate a file structure.
@@ -28,16 +31,9 @@ filealloc(void)
 {
   struct file *f;
 
-  acquire(&ftable.lock);
-  for(f = ftable.file; f < ftable.file + NFILE; f++){
-    if(f->ref == 0){
-      f->ref = 1;
-      release(&ftable.lock);
-      return f;
-    }
-  }
-  release(&ftable.lock);
-  return 0;
+  if((f = slaballoc(&ftable.cache)) != 0)
+    f->ref = 1;
+  return f;
 }
 
 // Increment ref count for file f.
@@ -69,6 +65,7 @@ fileclose(struct file *f)
   f->ref = 0;
   f->type = FD_NONE;
   release(&ftable.lock);
+  slabfree(&ftable.cache, f);
 
   if(ff.type == FD_PIPE)
     pipeclose(ff.pipe, ff.writable);
@@ -155,3 +152,39 @@ filewrite(struct file *f, char *addr, int n)
   panic("filewrite");
 }
 
+// Write n bytes from addr to f's inode at offset off,
+// leaving f->off alone.  Stops at the end of the file
+// rather than growing it.  Returns the number written,
+// or -1 if a write fails.
+int
+filewriteat(struct file *f, char *addr, uint off, int n)
+{
+  int r, n1, i;
+  int max = ((MAXOPBLOCKS-1-1-2) / 2) * 512;
+
+  if(f->type != FD_INODE)
+    return -1;
+  for(i = 0; i < n; i += r){
+    n1 = n - i;
+    if(n1 > max)
+      n1 = max;
+
+    begin_op();
+    ilock(f->ip);
+    r = 0;
+    if(off + i < f->ip->size){
+      if(n1 > f->ip->size - (off + i))
+        n1 = f->ip->size - (off + i);
+      r = writei(f->ip, addr + i, off + i, n1);
+    }
+    iunlock(f->ip);
+    end_op();
+
+    if(r < 0)
+      return -1;
+    if(r == 0)
+      break;
+  }
+  return i;
+}
+
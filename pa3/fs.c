@@ -14,12 +14,15 @@
 #include "param.h"
 #include "stat.h"
 #include "mmu.h"
+#include "rbtree.h"
 #include "proc.h"
 #include "spinlock.h"
+#include "waitq.h"
 #include "sleeplock.h"
 #include "fs.h"
 #include "buf.h"
 #include "file.h"
+#include "page.h"
 
 #define min(a, b) ((a) < (b) ? (a) : (b))
 static void itrunc(struct inode*);
@@ -411,6 +414,7 @@ itrunc(struct inode *ip)
   struct buf *bp;
   uint *a;
 
+  pcinval(ip);
   for(i = 0; i < NDIRECT; i++){
     if(ip->addrs[i]){
       bfree(ip->dev, ip->addrs[i]);
@@ -447,13 +451,32 @@ stati(struct inode *ip, struct stat *st)
 }
 
 //PAGEBREAK!
-// Read data from inode.
+// Read n bytes of ip at off from its blocks, which the
+// caller has checked lie within the file.
+static void
+readblocks(struct inode *ip, char *dst, uint off, uint n)
+{
+  uint tot, m;
+  struct buf *bp;
+
+  for(tot=0; tot<n; tot+=m, off+=m, dst+=m){
+    bp = bread(ip->dev, bmap(ip, off/BSIZE));
+    m = min(n - tot, BSIZE - off%BSIZE);
+    memmove(dst, bp->data + off%BSIZE, m);
+    brelse(bp);
+  }
+}
+
+// Read data from inode.  A read of a regular file uses the
+// page cache for a page already cached there, and fills the
+// cache only for a read of a whole page; a smaller read of
+// an uncached page reads just its own blocks.
 // Caller must hold ip->lock.
 int
 readi(struct inode *ip, char *dst, uint off, uint n)
 {
   uint tot, m;
-  struct buf *bp;
+  struct page *pg;
 
   if(ip->type == T_DEV){
     if(ip->major < 0 || ip->major >= NDEV || !devsw[ip->major].read)
@@ -466,8 +489,91 @@ readi(struct inode *ip, char *dst, uint off, uint n)
   if(off + n > ip->size)
     n = ip->size - off;
 
+  if(ip->type != T_FILE){
+    readblocks(ip, dst, off, n);
+    return n;
+  }
   for(tot=0; tot<n; tot+=m, off+=m, dst+=m){
-    bp = bread(ip->dev, bmap(ip, off/BSIZE));
+    m = min(n - tot, PGSIZE - off%PGSIZE);
+    if(off%PGSIZE == 0 && (m == PGSIZE || off + m == ip->size))
+      pg = pcget(ip, off/PGSIZE);
+    else
+      pg = pclookup(ip, off/PGSIZE);
+    if(pg != 0){
+      memmove(dst, pg->data + off%PGSIZE, m);
+      pcput(pg);
+    } else
+      readblocks(ip, dst, off, m);
+  }
+  return n;
+}
+
+// Fill mem with page pgno of ip, zero past the end of
+// the file.  Used by the page cache.
+// Caller must hold ip->lock.
+void
+ireadpage(struct inode *ip, uint pgno, char *mem)
+{
+  uint off;
+
+  memset(mem, 0, PGSIZE);
+  off = pgno * PGSIZE;
+  if(off < ip->size){
+    ireadahead(ip, off, PGSIZE);
+    readblocks(ip, mem, off, min(PGSIZE, ip->size - off));
+  }
+}
+
+// Like bmap, but never allocates or reads the disk.
+// Returns 0 if the block is not allocated or its
+// indirect block is not cached.
+static uint
+bmapcached(struct inode *ip, uint bn)
+{
+  uint addr;
+  struct buf *bp;
+
+  if(bn < NDIRECT)
+    return ip->addrs[bn];
+  bn -= NDIRECT;
+
+  if(bn < NINDIRECT && ip->addrs[NDIRECT] &&
+     (bp = bcached(ip->dev, ip->addrs[NDIRECT])) != 0){
+    addr = ((uint*)bp->data)[bn];
+    brelse(bp);
+    return addr;
+  }
+  return 0;
+}
+
+// Read data from inode like readi, but only if it is all
+// in the page cache or the buffer cache.  Returns -1 if
+// some would have to come from disk.
+// Caller must hold ip->lock.
+int
+readicached(struct inode *ip, char *dst, uint off, uint n)
+{
+  uint tot, m, addr;
+  struct buf *bp;
+  struct page *pg;
+
+  if(ip->type == T_DEV || off + n < off)
+    return -1;
+  if(off >= ip->size)
+    return 0;
+  if(off + n > ip->size)
+    n = ip->size - off;
+
+  for(tot=0; tot<n; tot+=m, off+=m, dst+=m){
+    if(ip->type == T_FILE && (pg = pclookup(ip, off/PGSIZE)) != 0){
+      m = min(n - tot, PGSIZE - off%PGSIZE);
+      memmove(dst, pg->data + off%PGSIZE, m);
+      pcput(pg);
+      continue;
+    }
+    if((addr = bmapcached(ip, off/BSIZE)) == 0 ||
+       (bp = bcached(ip->dev, addr)) == 0)
+      return -1;
     m = min(n - tot, BSIZE - off%BSIZE);
     memmove(dst, bp->data + off%BSIZE, m);
     brelse(bp);
@@ -475,6 +581,28 @@ readi(struct inode *ip, char *dst, uint off, uint n)
   return n;
 }
 
+// Start reading the blocks holding n bytes of ip at off
+// into the buffer cache, without waiting for them.
+// Caller must hold ip->lock.
+void
+ireadahead(struct inode *ip, uint off, uint n)
+{
+  uint bn, last;
+
+  if(ip->type == T_DEV || off >= ip->size)
+    return;
+  if(off + n > ip->size || off + n < off)
+    n = ip->size - off;
+
+  // Queue them all before the disk starts, so that runs
+  // of adjacent blocks go to it as one request.
+  last = (off + n - 1) / BSIZE;
+  ideplug();
+  for(bn = off/BSIZE; bn <= last; bn++)
+    breadahead(ip->dev, bmap(ip, bn));
+  ideunplug();
+}
+
 // PAGEBREAK!
 // Write data to inode.
 // Caller must hold ip->lock.
@@ -495,6 +623,8 @@ writei(struct inode *ip, char *src, uint off, uint n)
   if(off + n > MAXFILE*BSIZE)
     return -1;
 
+  if(ip->type == T_FILE)
+    pcupdate(ip, src, off, n);
   for(tot=0; tot<n; tot+=m, off+=m, src+=m){
     bp = bread(ip->dev, bmap(ip, off/BSIZE));
     m = min(n - tot, BSIZE - off%BSIZE);
@@ -1,14 +1,17 @@
-// Simple PIO-based (non-DMA) IDE driver code.
+// IDE driver code.  Uses bus-master DMA through the PCI IDE
+// controller when there is one, and PIO otherwise.
 
 #include "types.h"
 #include "defs.h"
 #include "param.h"
 #include "memlayout.h"
 #include "mmu.h"
+#include "rbtree.h"
 #include "proc.h"
 #include "x86.h"
 #include "traps.h"
 #include "spinlock.h"
+#include "waitq.h"
 #include "sleeplock.h"
 #include "fs.h"
 #include "buf.h"
@@ -23,16 +26,61 @@
 #define IDE_CMD_WRITE 0x30
 #define IDE_CMD_RDMUL 0xc4
 #define IDE_CMD_WRMUL 0xc5
+#define IDE_CMD_SETMULT 0xc6
+#define IDE_CMD_RDDMA 0xc8
+#define IDE_CMD_WRDMA 0xca
 
-// idequeue points to the buf now being read/written to the disk.
-// idequeue->qnext points to the next buf to be processed.
-// You must hold idelock while manipulating queue.
+// PCI configuration space ports.
+#define PCI_ADDR      0xcf8
+#define PCI_DATA      0xcfc
+#define PCI_CLASS_IDE 0x0101  // mass storage, IDE
+
+// Bus-master registers, at offsets from idebm, and the
+// physical region descriptor (PRD) flag ending a table.
+#define BM_CMD        0
+#define BM_STATUS     2
+#define BM_PRDT       4
+#define BM_START      0x01  // BM_CMD: start transfer
+#define BM_READ       0x08  // BM_CMD: disk to memory
+#define BM_ERR        0x02  // BM_STATUS: transfer failed
+#define BM_INTR       0x04  // BM_STATUS: disk interrupted
+#define PRD_EOT       0x8000
+
+#define IDEMAXSECT    16  // sectors per READ/WRITE MULTIPLE interrupt
+
+// idequeue holds the bufs waiting for the disk, sorted by
+// dev and blockno.  The disk serves them in elevator order,
+// sweeping up from idepos and then starting again at the
+// bottom, and each command takes a run of up to idemult
+// sectors of adjacent blocks going the same way.
+// ideactive is the run now on the disk, linked by qnext.
+// You must hold idelock while manipulating the queue.
 
 static struct spinlock idelock;
 static struct buf *idequeue;
+static struct buf *ideactive;
+static uint idepos;      // dev<<28 | blockno where the last run ended
+static int idemult = 1;  // sectors the disk moves per interrupt
+static int ideplugs;     // ideplug() calls not yet undone
+
+// One contiguous piece of physical memory for a DMA transfer.
+// It may not cross a 64KB boundary, so a block can take two.
+struct prd {
+  uint addr;
+  ushort count;
+  ushort flags;
+};
+
+static ushort idebm;     // bus-master I/O port base, 0 for PIO
+static struct prd prdt[2*IDEMAXSECT] __attribute__((aligned(256)));
+
+// Counts for iostat().
+static uint idenintr;    // commands completed, one interrupt each
+static uint idensect;    // sectors they moved
 
 static int havedisk1;
-static void idestart(struct buf*);
+static void idestart(void);
+static void idesort(struct buf*);
 
 // Wait for IDE disk to become ready.
 static int
@@ -47,6 +95,45 @@ idewait(int checkerr)
   return 0;
 }
 
+static uint
+pciread(int dev, int fn, int off)
+{
+  outl(PCI_ADDR, 0x80000000 | dev<<11 | fn<<8 | off);
+  return inl(PCI_DATA);
+}
+
+static void
+pciwrite(int dev, int fn, int off, uint v)
+{
+  outl(PCI_ADDR, 0x80000000 | dev<<11 | fn<<8 | off);
+  outl(PCI_DATA, v);
+}
+
+// Look on PCI bus 0 for an IDE controller that can do
+// bus-master DMA, and set idebm to its registers.
+static void
+idedmainit(void)
+{
+  int dev, fn;
+  uint bar;
+
+  for(dev = 0; dev < 32; dev++){
+    for(fn = 0; fn < 8; fn++){
+      if(pciread(dev, fn, 0) == 0xffffffff)
+        continue;
+      if(pciread(dev, fn, 8)>>16 != PCI_CLASS_IDE)
+        continue;
+      bar = pciread(dev, fn, 0x20);
+      if((bar & 1) == 0 || (bar & ~3) == 0)
+        continue;
+      // Enable I/O space and bus mastering.
+      pciwrite(dev, fn, 4, (pciread(dev, fn, 4) & 0xffff) | 0x5);
+      idebm = bar & 0xfffc;
+      return;
+    }
+  }
+}
+
 void
 ideinit(void)
 {
@@ -65,35 +152,125 @@ ideinit(void)
     }
   }
 
+  // A DMA command moves up to IDEMAXSECT sectors.
+  // Otherwise let READ/WRITE MULTIPLE move as many per
+  // interrupt, on each disk there is.
+  idedmainit();
+  idemult = IDEMAXSECT;
+  for(i = 0; i <= havedisk1 && idebm == 0; i++){
+    outb(0x1f6, 0xe0 | (i<<4));
+    idewait(0);
+    outb(0x1f2, IDEMAXSECT);
+    outb(0x1f7, IDE_CMD_SETMULT);
+    if(idewait(1) < 0)
+      idemult = 1;
+  }
+
   // Switch back to disk 0.
   outb(0x1f6, 0xe0 | (0<<4));
 }
 
-// Start the request for b.  Caller must hold idelock.
+// Sort key of b: where it lies on the disks.
+static uint
+idekey(struct buf *b)
+{
+  return (b->dev&1)<<28 | b->blockno;
+}
+
+// Start a DMA transfer of the run of bufs at b, which is
+// n sectors long.  Caller must hold idelock.
 static void
-idestart(struct buf *b)
+idedma(struct buf *b, int n)
 {
-  if(b == 0)
-    panic("idestart");
-  if(b->blockno >= FSSIZE)
-    panic("incorrect blockno");
-  int sector_per_block =  BSIZE/SECTOR_SIZE;
-  int sector = b->blockno * sector_per_block;
-  int read_cmd = (sector_per_block == 1) ? IDE_CMD_READ :  IDE_CMD_RDMUL;
-  int write_cmd = (sector_per_block == 1) ? IDE_CMD_WRITE : IDE_CMD_WRMUL;
+  struct buf *x;
+  uint pa, m, len;
+  int i, sector, dir;
 
+  // Describe the buffers' physical memory in prdt.
+  i = 0;
+  for(x = b; x; x = x->qnext){
+    pa = V2P(x->data);
+    for(len = BSIZE; len > 0; len -= m, pa += m){
+      m = 0x10000 - (pa & 0xffff);
+      if(m > len)
+        m = len;
+      prdt[i].addr = pa;
+      prdt[i].count = m;
+      prdt[i].flags = 0;
+      i++;
+    }
+  }
+  prdt[i-1].flags = PRD_EOT;
+
+  dir = (b->flags & B_DIRTY) ? 0 : BM_READ;
+  outl(idebm+BM_PRDT, V2P(prdt));
+  outb(idebm+BM_CMD, dir);
+  outb(idebm+BM_STATUS, BM_ERR|BM_INTR);  // clear them
+
+  sector = b->blockno * (BSIZE/SECTOR_SIZE);
+  idewait(0);
+  outb(0x3f6, 0);  // generate interrupt
+  outb(0x1f2, n);  // number of sectors
+  outb(0x1f3, sector & 0xff);
+  outb(0x1f4, (sector >> 8) & 0xff);
+  outb(0x1f5, (sector >> 16) & 0xff);
+  outb(0x1f6, 0xe0 | ((b->dev&1)<<4) | ((sector>>24)&0x0f));
+  outb(0x1f7, dir ? IDE_CMD_RDDMA : IDE_CMD_WRDMA);
+  outb(idebm+BM_CMD, dir | BM_START);
+}
+
+// Take the next run of bufs off idequeue into ideactive
+// and start the disk on it.  Caller must hold idelock.
+static void
+idestart(void)
+{
+  struct buf **pp, *b, *x;
+  int sector_per_block, n, sector, read_cmd, write_cmd;
+
+  if(idequeue == 0)
+    return;
+  // The first buf at or past idepos, or else the lowest.
+  for(pp = &idequeue; *pp && idekey(*pp) < idepos; pp = &(*pp)->qnext)
+    ;
+  if(*pp == 0)
+    pp = &idequeue;
+  b = *pp;
+  sector_per_block = BSIZE/SECTOR_SIZE;
   if (sector_per_block > 7) panic("idestart");
 
+  // Add the bufs for the blocks after b going the same way.
+  for(n = 1, x = b; x->qnext && (n+1)*sector_per_block <= idemult; n++){
+    if(x->qnext->dev != b->dev || x->qnext->blockno != x->blockno + 1 ||
+       (x->qnext->flags & B_DIRTY) != (b->flags & B_DIRTY))
+      break;
+    x = x->qnext;
+  }
+  *pp = x->qnext;
+  x->qnext = 0;
+  ideactive = b;
+  idepos = idekey(x) + 1;
+  if(b->blockno + n > FSSIZE + SWAPBLOCKS)
+    panic("incorrect blockno");
+
+  sector = b->blockno * sector_per_block;
+  if(idebm){
+    idedma(b, n*sector_per_block);
+    return;
+  }
+  read_cmd = (n*sector_per_block == 1) ? IDE_CMD_READ :  IDE_CMD_RDMUL;
+  write_cmd = (n*sector_per_block == 1) ? IDE_CMD_WRITE : IDE_CMD_WRMUL;
+
   idewait(0);
   outb(0x3f6, 0);  // generate interrupt
-  outb(0x1f2, sector_per_block);  // number of sectors
+  outb(0x1f2, n*sector_per_block);  // number of sectors
   outb(0x1f3, sector & 0xff);
   outb(0x1f4, (sector >> 8) & 0xff);
   outb(0x1f5, (sector >> 16) & 0xff);
   outb(0x1f6, 0xe0 | ((b->dev&1)<<4) | ((sector>>24)&0x0f));
   if(b->flags & B_DIRTY){
     outb(0x1f7, write_cmd);
-    outsl(0x1f0, b->data, BSIZE/4);
+    for(x = b; x; x = x->qnext)
+      outsl(0x1f0, x->data, BSIZE/4);
   } else {
     outb(0x1f7, read_cmd);
   }
@@ -103,33 +280,145 @@ idestart(struct buf *b)
 void
 ideintr(void)
 {
-  struct buf *b;
+  struct buf *b, *next, *async[IDEMAXSECT];
+  int i, n, nasync, st;
 
-  // First queued buffer is the active request.
+  // ideactive is the run the disk has just finished.
   acquire(&idelock);
 
-  if((b = idequeue) == 0){
+  if((b = ideactive) == 0){
     release(&idelock);
     return;
   }
-  idequeue = b->qnext;
+  ideactive = 0;
 
-  // Read data if needed.
-  if(!(b->flags & B_DIRTY) && idewait(1) >= 0)
-    insl(0x1f0, b->data, BSIZE/4);
+  // Read data if needed.  With DMA it is already in
+  // memory; stop the controller.  If the transfer failed,
+  // give up on DMA and do the run again by PIO.
+  if(idebm){
+    st = inb(idebm+BM_STATUS);
+    outb(idebm+BM_CMD, 0);
+    outb(idebm+BM_STATUS, BM_ERR|BM_INTR);
+    if((st & BM_ERR) || idewait(1) < 0){
+      cprintf("ide: DMA failed, using PIO\n");
+      idebm = 0;
+      idemult = 1;
+      for(; b; b = next){
+        next = b->qnext;
+        idesort(b);
+      }
+      idestart();
+      release(&idelock);
+      return;
+    }
+  } else if(!(b->flags & B_DIRTY) && idewait(1) >= 0)
+    for(next = b; next; next = next->qnext)
+      insl(0x1f0, next->data, BSIZE/4);
 
-  // Wake process waiting for this buf.
-  b->flags |= B_VALID;
-  b->flags &= ~B_DIRTY;
-  wakeup(b);
+  // Wake the processes waiting for these bufs.
+  n = nasync = 0;
+  for(; b; b = next, n++){
+    next = b->qnext;
+    b->flags |= B_VALID;
+    b->flags &= ~B_DIRTY;
+    if(b->flags & B_ASYNC)
+      async[nasync++] = b;
+    wakeupq(&b->wait);
+  }
+  idenintr++;
+  idensect += n * (BSIZE/SECTOR_SIZE);
+
+  // Start disk on the next run.  Plugging only holds back
+  // an idle disk; a busy one moves on to whatever is queued.
+  idestart();
+
+  release(&idelock);
+
+  // Nobody waits for a read-ahead; release it here.
+  for(i = 0; i < nasync; i++)
+    bdone(async[i]);
+}
+
+// Insert b into idequeue in sorted order.
+// Caller must hold idelock.
+static void
+idesort(struct buf *b)
+{
+  struct buf **pp;
+
+  for(pp=&idequeue; *pp && idekey(*pp) <= idekey(b); pp=&(*pp)->qnext)  //DOC:insert-queue
+    ;
+  b->qnext = *pp;
+  *pp = b;
+}
+
+// Insert b into idequeue, and start the disk if it is
+// idle and not plugged, or if sync is set.
+// Caller must hold idelock.
+static void
+ideappend(struct buf *b, int sync)
+{
+  idesort(b);
+
+  // Start disk if necessary.
+  if(ideactive == 0 && (ideplugs == 0 || sync))
+    idestart();
+}
+
+// Hold back the disk from starting on ideasync() requests
+// until the matching ideunplug(), so that a run of them
+// queued together can go as one command.
+void
+ideplug(void)
+{
+  acquire(&idelock);
+  ideplugs++;
+  release(&idelock);
+}
 
-  // Start disk on next buf in queue.
-  if(idequeue != 0)
-    idestart(idequeue);
+void
+ideunplug(void)
+{
+  acquire(&idelock);
+  if(--ideplugs == 0 && ideactive == 0)
+    idestart();
+  release(&idelock);
+}
 
+// Queue a read of b and return without waiting.  b must be
+// locked and have B_ASYNC set; ideintr calls bdone(b) once
+// the data is in.
+void
+ideasync(struct buf *b)
+{
+  if(!holdingsleep(&b->lock))
+    panic("ideasync: buf not locked");
+  if(b->flags & (B_VALID|B_DIRTY))
+    panic("ideasync: not a read");
+  if(b->dev != 0 && !havedisk1)
+    panic("ideasync: ide disk 1 not present");
+
+  acquire(&idelock);
+  ideappend(b, 0);
   release(&idelock);
 }
 
+// Copy the disk's counts of commands and of sectors moved
+// into counts[0] and counts[1].
+void
+iostat(uint *counts)
+{
+  uint nintr, nsect;
+
+  acquire(&idelock);
+  nintr = idenintr;
+  nsect = idensect;
+  release(&idelock);
+  // counts is user memory; a store to it may fault.
+  counts[0] = nintr;
+  counts[1] = nsect;
+}
+
 //PAGEBREAK!
 // Sync buf with disk.
 // If B_DIRTY is set, write buf to disk, clear B_DIRTY, set B_VALID.
@@ -137,8 +426,6 @@ ideintr(void)
 void
 iderw(struct buf *b)
 {
-  struct buf **pp;
-
   if(!holdingsleep(&b->lock))
     panic("iderw: buf not locked");
   if((b->flags & (B_VALID|B_DIRTY)) == B_VALID)
@@ -148,19 +435,11 @@ iderw(struct buf *b)
 
   acquire(&idelock);  //DOC:acquire-lock
 
-  // Append b to idequeue.
-  b->qnext = 0;
-  for(pp=&idequeue; *pp; pp=&(*pp)->qnext)  //DOC:insert-queue
-    ;
-  *pp = b;
-
-  // Start disk if necessary.
-  if(idequeue == b)
-    idestart(b);
+  ideappend(b, 1);
 
   // Wait for request to finish.
   while((b->flags & (B_VALID|B_DIRTY)) != B_VALID){
-    sleep(b, &idelock);
+    sleepq(&b->wait, &idelock);
   }
 
 
@@ -1,27 +1,64 @@
 // Physical memory allocator, intended to allocate
 // memory for user processes, kernel stacks, page table pages,
-// and pipe buffers. Allocates 4096-byte pages.
+// and pipe buffers. Allocates 4096-byte pages, or physically
+// contiguous blocks of 2^order pages with kalloc_order().
+//
+// Free memory is kept by a buddy allocator: a free list per
+// order, where a block of 2^order pages starts at a multiple
+// of its size, and a freed block merges with its buddy (the
+// other half of the next order's block) when that is free.
+//
+// Each cpu keeps a magazine of single free pages and only
+// takes kmem.lock to move KBATCH pages between its magazine
+// and the buddy lists.  An idle cpu also zeroes up to
+// KZERO free pages ahead of time for kalloc_zeroed().
+// A magazine's lock is normally taken only by its own cpu;
+// an allocation that finds no free memory takes the others
+// to drain every magazine back to the buddy lists.
+//
+// Build with -DJUNKFILL to fill freed pages with junk.
 
 #include "types.h"
 #include "defs.h"
 #include "param.h"
 #include "memlayout.h"
 #include "mmu.h"
+#include "x86.h"
 #include "spinlock.h"
 
-uint freememC;
+#define KBATCH  32  // pages moved between a magazine and freelist
+#define KMAG    64  // most pages a magazine holds
+#define KZERO   64  // most pre-zeroed pages a cpu holds
+
 void freerange(void *vstart, void *vend);
 extern char end[]; // first address after kernel loaded from ELF file
                    // defined by the kernel linker script in kernel.ld
 
 struct run {
   struct run *next;
+  struct run *prev;            // only on the buddy lists
+};
+
+#define NPFN    (PHYSTOP/PGSIZE)
+#define PFN(v)  (V2P(v)/PGSIZE)
+#define PFNRUN(pfn)  ((struct run*)P2V((pfn)*PGSIZE))
+
+struct kmag {
+  struct spinlock lock;
+  struct run *freelist;
+  int nfree;
+  struct run *zeroed;          // free pages already zeroed
+  int nzero;
 };
 
 struct {
   struct spinlock lock;
   int use_lock;
-  struct run *freelist;
+  struct run free[MAXORDER+1]; // buddy list heads, by order
+  int nfree[MAXORDER+1];       // blocks on each list
+  uchar head[NPFN];            // order+1 if pfn heads a free block
+  struct kmag mag[NCPU];       // per-cpu free pages
+  int ref[NPFN];               // page tables mapping each page
 } kmem;
 
 // Initialization happens in two phases.
@@ -32,10 +69,15 @@ struct {
 void
 kinit1(void *vstart, void *vend)
 {
+  int o;
+
   initlock(&kmem.lock, "kmem");
+  for(o = 0; o < NCPU; o++)
+    initlock(&kmem.mag[o].lock, "kmag");
   kmem.use_lock = 0;
+  for(o = 0; o <= MAXORDER; o++)
+    kmem.free[o].next = kmem.free[o].prev = &kmem.free[o];
   freerange(vstart, vend);
-  freememC = 0;
 }
 
 void
@@ -50,33 +92,208 @@ freerange(void *vstart, void *vend)
 {
   char *p;
   p = (char*)PGROUNDUP((uint)vstart);
-  for(; p + PGSIZE <= (char*)vend; p += PGSIZE)
+  for(; p + PGSIZE <= (char*)vend; p += PGSIZE){
+    kmem.ref[V2P(p)/PGSIZE] = 1;
     kfree(p);
+  }
 }
+
+// Put the block at pfn on the order list.
+// Caller holds kmem.lock.
+static void
+bpush(uint pfn, int order)
+{
+  struct run *r, *h;
+
+  r = PFNRUN(pfn);
+  h = &kmem.free[order];
+  r->next = h->next;
+  r->prev = h;
+  h->next->prev = r;
+  h->next = r;
+  kmem.head[pfn] = order + 1;
+  kmem.nfree[order]++;
+}
+
+// Take the block at pfn off the order list.
+// Caller holds kmem.lock.
+static void
+bunlink(uint pfn, int order)
+{
+  struct run *r;
+
+  r = PFNRUN(pfn);
+  r->prev->next = r->next;
+  r->next->prev = r->prev;
+  kmem.head[pfn] = 0;
+  kmem.nfree[order]--;
+}
+
+// Free the 2^order pages at pfn, merging with free buddies.
+// Caller holds kmem.lock.
+static void
+bfree(uint pfn, int order)
+{
+  uint buddy;
+
+  for(; order < MAXORDER; order++){
+    buddy = pfn ^ (1 << order);
+    if(buddy >= NPFN || kmem.head[buddy] != order + 1)
+      break;
+    bunlink(buddy, order);
+    pfn &= ~(1 << order);
+  }
+  bpush(pfn, order);
+}
+
+// Allocate 2^order contiguous pages, splitting a larger
+// free block if need be.  Returns the first pfn, or 0 if
+// there is no block that large (pfn 0 is never free).
+// Caller holds kmem.lock.
+static uint
+balloc(int order)
+{
+  uint pfn;
+  int o;
+
+  for(o = order; o <= MAXORDER && kmem.nfree[o] == 0; o++)
+    ;
+  if(o > MAXORDER)
+    return 0;
+  pfn = PFN(kmem.free[o].next);
+  bunlink(pfn, o);
+  // Give back the upper halves.
+  while(o > order){
+    o--;
+    bpush(pfn + (1 << o), o);
+  }
+  return pfn;
+}
+
+// Move up to n pages from the buddy lists to m.
+static void
+kmagfill(struct kmag *m, int n)
+{
+  struct run *r;
+  uint pfn;
+
+  acquire(&kmem.lock);
+  for(; n > 0 && (pfn = balloc(0)) != 0; n--){
+    r = PFNRUN(pfn);
+    r->next = m->freelist;
+    m->freelist = r;
+    m->nfree++;
+  }
+  release(&kmem.lock);
+}
+
+// Move n pages from m back to the buddy lists.
+static void
+kmagdrain(struct kmag *m, int n)
+{
+  struct run *r;
+
+  acquire(&kmem.lock);
+  for(; n > 0 && (r = m->freelist) != 0; n--){
+    m->freelist = r->next;
+    m->nfree--;
+    bfree(PFN(r), 0);
+  }
+  release(&kmem.lock);
+}
+
+// Move the pages in every cpu's magazine, zeroed or not,
+// back to the buddy lists, so that an allocation can use
+// pages stranded on other cpus.  Caller must not hold a
+// magazine lock.
+static void
+kmagdrainall(void)
+{
+  struct kmag *m;
+  struct run *r;
+
+  for(m = kmem.mag; m < &kmem.mag[NCPU]; m++){
+    acquire(&m->lock);
+    acquire(&kmem.lock);
+    while((r = m->freelist) != 0){
+      m->freelist = r->next;
+      bfree(PFN(r), 0);
+    }
+    while((r = m->zeroed) != 0){
+      m->zeroed = r->next;
+      bfree(PFN(r), 0);
+    }
+    m->nfree = m->nzero = 0;
+    release(&kmem.lock);
+    release(&m->lock);
+  }
+}
+
+// Take a page from this cpu's magazine, refilling it from
+// the buddy lists if empty, and failing that a zeroed page.
+static struct run*
+kmagget(void)
+{
+  struct run *r;
+  struct kmag *m;
+
+  pushcli();
+  m = &kmem.mag[cpuid()];
+  acquire(&m->lock);
+  if(m->freelist == 0)
+    kmagfill(m, KBATCH);
+  if((r = m->freelist) != 0){
+    m->freelist = r->next;
+    m->nfree--;
+  } else if((r = m->zeroed) != 0){
+    m->zeroed = r->next;
+    m->nzero--;
+  }
+  release(&m->lock);
+  popcli();
+  return r;
+}
+
 //PAGEBREAK: 21
-// Free the page of physical memory pointed at by v,
-// which normally should have been returned by a
-// call to kalloc().  (The exception is when
-// initializing the allocator; see kinit above.)
+// Drop a reference to the page of physical memory pointed
+// at by v, and free it if that was the last one.  v
+// normally should have been returned by a call to kalloc().
+// (The exception is when initializing the allocator; see
+// kinit above.)
 void
 kfree(char *v)
 {
   struct run *r;
+  struct kmag *m;
 
   if((uint)v % PGSIZE || v < end || V2P(v) >= PHYSTOP)
     panic("kfree");
 
+  if(xadd(&kmem.ref[V2P(v)/PGSIZE], -1) > 1)
+    return;
+
+#ifdef JUNKFILL
   // Fill with junk to catch dangling refs.
   memset(v, 1, PGSIZE);
-  freememC++;
-  
-  if(kmem.use_lock)
-    acquire(&kmem.lock);
+#endif
+
   r = (struct run*)v;
-  r->next = kmem.freelist;
-  kmem.freelist = r;
-  if(kmem.use_lock)
-    release(&kmem.lock);
+  if(!kmem.use_lock){
+    // Only one cpu is running yet.
+    bfree(PFN(v), 0);
+    return;
+  }
+
+  pushcli();
+  m = &kmem.mag[cpuid()];
+  acquire(&m->lock);
+  r->next = m->freelist;
+  m->freelist = r;
+  m->nfree++;
+  if(m->nfree >= KMAG)
+    kmagdrain(m, KBATCH);
+  release(&m->lock);
+  popcli();
 }
 
 // Allocate one 4096-byte page of physical memory.
@@ -86,19 +303,191 @@ char*
 kalloc(void)
 {
   struct run *r;
-  freememC--;
+  uint pfn;
+
+  if(!kmem.use_lock){
+    pfn = balloc(0);
+    r = pfn ? PFNRUN(pfn) : 0;
+  } else if((r = kmagget()) == 0){
+    kmagdrainall();
+    r = kmagget();
+  }
+  if(r)
+    kmem.ref[V2P(r)/PGSIZE] = 1;
+  return (char*)r;
+}
+
+// Allocate 2^order physically contiguous pages, aligned
+// to their size.  Free them with kfree_order().
+// Returns 0 if the memory cannot be allocated.
+char*
+kalloc_order(int order)
+{
+  uint pfn;
+
+  if(order < 0 || order > MAXORDER)
+    return 0;
+  if(order == 0)
+    return kalloc();
 
   if(kmem.use_lock)
     acquire(&kmem.lock);
-  r = kmem.freelist;
-  if(r)
-    kmem.freelist = r->next;
+  pfn = balloc(order);
   if(kmem.use_lock)
     release(&kmem.lock);
+  if(pfn == 0 && kmem.use_lock){
+    // Free pages sitting in magazines may complete a block.
+    kmagdrainall();
+    acquire(&kmem.lock);
+    pfn = balloc(order);
+    release(&kmem.lock);
+  }
+  if(pfn == 0)
+    return 0;
+  kmem.ref[pfn] = 1;
+  return (char*)PFNRUN(pfn);
+}
+
+// Free the 2^order pages at v from kalloc_order(order).
+void
+kfree_order(char *v, int order)
+{
+  if(order == 0){
+    kfree(v);
+    return;
+  }
+  if(order < 0 || order > MAXORDER ||
+     (uint)v % (PGSIZE << order) || v < end || V2P(v) + (PGSIZE << order) > PHYSTOP)
+    panic("kfree_order");
+
+  kmem.ref[PFN(v)] = 0;
+#ifdef JUNKFILL
+  memset(v, 1, PGSIZE << order);
+#endif
+  if(kmem.use_lock)
+    acquire(&kmem.lock);
+  bfree(PFN(v), order);
+  if(kmem.use_lock)
+    release(&kmem.lock);
+}
+
+// Allocate one zero-filled page, from this cpu's pool of
+// pages zeroed while idle if it has one.
+// Returns 0 if the memory cannot be allocated.
+char*
+kalloc_zeroed(void)
+{
+  struct run *r;
+  struct kmag *m;
+
+  r = 0;
+  if(kmem.use_lock){
+    pushcli();
+    m = &kmem.mag[cpuid()];
+    acquire(&m->lock);
+    if((r = m->zeroed) != 0){
+      m->zeroed = r->next;
+      m->nzero--;
+    }
+    release(&m->lock);
+    popcli();
+  }
+  if(r){
+    r->next = 0;  // the only word the list wrote
+    kmem.ref[V2P(r)/PGSIZE] = 1;
+    return (char*)r;
+  }
+  if((r = (struct run*)kalloc()) != 0)
+    memset(r, 0, PGSIZE);
   return (char*)r;
 }
 
+// Zero one free page into this cpu's kalloc_zeroed() pool,
+// unless the pool is full.  Called from the idle loop, with
+// interrupts on: the page is off every list meanwhile.
+void
+kzero(void)
+{
+  struct run *r;
+  struct kmag *m;
+
+  if(!kmem.use_lock)
+    return;
+  pushcli();
+  m = &kmem.mag[cpuid()];
+  acquire(&m->lock);
+  r = 0;
+  if(m->nzero < KZERO){
+    if(m->freelist == 0)
+      kmagfill(m, KBATCH);
+    if((r = m->freelist) != 0){
+      m->freelist = r->next;
+      m->nfree--;
+    }
+  }
+  release(&m->lock);
+  popcli();
+  if(r == 0)
+    return;
+
+  memset(r, 0, PGSIZE);
+
+  pushcli();
+  m = &kmem.mag[cpuid()];
+  acquire(&m->lock);
+  r->next = m->zeroed;
+  m->zeroed = r;
+  m->nzero++;
+  release(&m->lock);
+  popcli();
+}
+
+// Add a reference to the allocated page pointed at by v,
+// which another page table now maps too.  kfree() drops it.
+void
+kref(char *v)
+{
+  if((uint)v % PGSIZE || v < end || V2P(v) >= PHYSTOP)
+    panic("kref");
+
+  if(xadd(&kmem.ref[V2P(v)/PGSIZE], 1) == 0)
+    panic("kref: free page");
+}
+
+// Return the number of references to the page at v.
+int
+krefcount(char *v)
+{
+  return kmem.ref[V2P(v)/PGSIZE];
+}
+
+// Count the free pages, on the global list and in every
+// cpu's magazine.  Pages moving between the two while we
+// look may be missed or counted twice.
 int freememCount(void)
 {
-  return freememC;
+  int i, n;
+
+  n = 0;
+  for(i = 0; i <= MAXORDER; i++)
+    n += kmem.nfree[i] << i;
+  for(i = 0; i < NCPU; i++)
+    n += kmem.mag[i].nfree + kmem.mag[i].nzero;
+  return n;
+}
+
+// Print the free block counts of each order, and the
+// pages held in each cpu's magazines, for ps -m.
+void
+kmemstat(void)
+{
+  int i;
+
+  cprintf("order  free blocks\n");
+  for(i = 0; i <= MAXORDER; i++)
+    cprintf("%d      %d\n", i, kmem.nfree[i]);
+  for(i = 0; i < NCPU; i++)
+    if(kmem.mag[i].nfree || kmem.mag[i].nzero)
+      cprintf("cpu%d   %d free, %d zeroed\n", i, kmem.mag[i].nfree, kmem.mag[i].nzero);
+  cprintf("total  %d pages\n", freememCount());
 }
@@ -32,6 +32,7 @@
 #define TIMER   (0x0320/4)   // Local Vector Table 0 (TIMER)
   #define X1         0x0000000B   // divide counts by 1
   #define PERIODIC   0x00020000   // Periodic
+  #define ONESHOT    0x00000000   // One-shot
 #define PCINT   (0x0340/4)   // Performance Counter LVT
 #define LINT0   (0x0350/4)   // Local Vector Table 1 (LINT0)
 #define LINT1   (0x0360/4)   // Local Vector Table 2 (LINT1)
@@ -43,6 +44,31 @@
 
 volatile uint *lapic;  // Initialized in mp.c
 
+// One clock tick is TICKCOUNT bus cycles of the timer;
+// tscpertick is the same interval in TSC cycles.
+#define TICKCOUNT 10000000
+uint tscpertick;
+
+// Without a local APIC, time 10ms of PIT channel 2
+// (1193182 Hz) with the TSC instead.
+#define PITHZ     1193182
+#define PITCOUNT  (PITHZ/100)
+
+static uint
+pittsc(void)
+{
+  uint64 t0;
+
+  outb(0x61, (inb(0x61) & ~0x02) | 0x01);  // gate on, speaker off
+  outb(0x43, 0xb0);  // channel 2, lo/hi byte, count down once
+  outb(0x42, PITCOUNT & 0xff);
+  outb(0x42, PITCOUNT >> 8);
+  t0 = rdtsc();
+  while((inb(0x61) & 0x20) == 0)
+    ;
+  return rdtsc() - t0;
+}
+
 //PAGEBREAK!
 static void
 lapicw(int index, int value)
@@ -54,19 +80,34 @@ lapicw(int index, int value)
 void
 lapicinit(void)
 {
-  if(!lapic)
+  if(!lapic){
+    if(tscpertick == 0 && (tscpertick = pittsc()) == 0)
+      tscpertick = TICKCOUNT;
     return;
+  }
 
   // Enable local APIC; set spurious interrupt vector.
   lapicw(SVR, ENABLE | (T_IRQ0 + IRQ_SPURIOUS));
 
-  // The timer repeatedly counts down at bus frequency
-  // from lapic[TICR] and then issues an interrupt.
-  // If xv6 cared more about precise timekeeping,
-  // TICR would be calibrated using an external time source.
+  // The timer counts down at bus frequency from lapic[TICR]
+  // and then issues an interrupt.  It runs in one-shot mode:
+  // trap() re-arms it for the next tick or the end of the
+  // running process's slice, whichever is sooner.
+  // The boot cpu first times a tenth of a tick with the
+  // TSC, so run time can be measured in TSC cycles.
   lapicw(TDCR, X1);
-  lapicw(TIMER, PERIODIC | (T_IRQ0 + IRQ_TIMER));
-  lapicw(TICR, 10000000);
+  if(tscpertick == 0){
+    uint64 t0;
+
+    lapicw(TIMER, MASKED);
+    lapicw(TICR, TICKCOUNT/10);
+    t0 = rdtsc();
+    while(lapic[TCCR] != 0)
+      ;
+    tscpertick = (rdtsc() - t0) * 10;
+  }
+  lapicw(TIMER, ONESHOT | (T_IRQ0 + IRQ_TIMER));
+  lapicw(TICR, TICKCOUNT);
 
   // Disable logical interrupt lines.
   lapicw(LINT0, MASKED);
@@ -105,6 +146,36 @@ lapicid(void)
   return lapic[ID] >> 24;
 }
 
+// Arm the timer to interrupt after cycles TSC cycles,
+// but no later than one tick from now.
+void
+lapiconeshot(uint64 cycles)
+{
+  uint count;
+
+  if(!lapic)
+    return;
+  if(cycles >= tscpertick)
+    count = TICKCOUNT;
+  else
+    count = divu64(cycles * TICKCOUNT, tscpertick);
+  if(count == 0)
+    count = 1;
+  lapicw(TICR, count);
+}
+
+// Send interrupt vector to the cpu with the given APIC ID.
+void
+lapicipi(uchar apicid, int vector)
+{
+  if(!lapic)
+    return;
+  lapicw(ICRHI, apicid<<24);
+  lapicw(ICRLO, FIXED | vector);
+  while(lapic[ICRLO] & DELIVS)
+    ;
+}
+
 // Acknowledge interrupt.
 void
 lapiceoi(void)
@@ -2,6 +2,7 @@
 #include "defs.h"
 #include "param.h"
 #include "spinlock.h"
+#include "waitq.h"
 #include "sleeplock.h"
 #include "fs.h"
 #include "buf.h"
@@ -43,6 +44,7 @@ struct log {
   int outstanding; // how many FS sys calls are executing.
   int committing;  // in commit(), please wait.
   int dev;
+  struct waitq wait; // begin_op() waiting for commit or log space
   struct logheader lh;
 };
 struct log log;
@@ -58,6 +60,7 @@ initlog(int dev)
 
   struct superblock sb;
   initlock(&log.lock, "log");
+  initwaitq(&log.wait);
   readsb(dev, &sb);
   log.start = sb.logstart;
   log.size = sb.nlog;
@@ -128,10 +131,10 @@ begin_op(void)
   acquire(&log.lock);
   while(1){
     if(log.committing){
-      sleep(&log, &log.lock);
+      sleepq(&log.wait, &log.lock);
     } else if(log.lh.n + (log.outstanding+1)*MAXOPBLOCKS > LOGSIZE){
       // this op might exhaust log space; wait for commit.
-      sleep(&log, &log.lock);
+      sleepq(&log.wait, &log.lock);
     } else {
       log.outstanding += 1;
       release(&log.lock);
@@ -158,7 +161,7 @@ end_op(void)
     // begin_op() may be waiting for log space,
     // and decrementing log.outstanding has decreased
     // the amount of reserved space.
-    wakeup(&log);
+    wakeupq(&log.wait);
   }
   release(&log.lock);
 
@@ -168,7 +171,7 @@ end_op(void)
     commit();
     acquire(&log.lock);
     log.committing = 0;
-    wakeup(&log);
+    wakeupq(&log.wait);
     release(&log.lock);
   }
 }
@@ -3,6 +3,7 @@
 #include "param.h"
 #include "memlayout.h"
 #include "mmu.h"
+#include "rbtree.h"
 #include "proc.h"
 #include "x86.h"
 
@@ -26,9 +27,12 @@ main(void){
   consoleinit();   // console hardware
   uartinit();      // serial port
   pinit();         // process table
+  vmainit();       // mmap regions
   tvinit();        // trap vectors
   binit();         // buffer cache
+  pcinit();        // page cache
   fileinit();      // file table
+  pipeinit();      // pipe buffers
   ideinit();       // disk 
   startothers();   // start other processors
   kinit2(P2V(4*1024*1024), P2V(PHYSTOP)); // must come after startothers()
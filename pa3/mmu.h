@@ -10,6 +10,7 @@
 #define CR0_PG          0x80000000      // Paging
 
 #define CR4_PSE         0x00000010      // Page size extension
+#define CR4_PGE         0x00000080      // Page global enable
 
 // various segment selectors.
 #define SEG_KCODE 1  // kernel code
@@ -87,8 +88,13 @@ struct segdesc {
 #define PTXSHIFT        12      // offset of PTX in a linear address
 #define PDXSHIFT        22      // offset of PDX in a linear address
 
+#define HUGEPGSIZE      (1 << PDXSHIFT)  // bytes mapped by a PTE_PS PDE
+#define HUGEORDER       (PDXSHIFT - PTXSHIFT)  // kalloc_order() of one
+
 #define PGROUNDUP(sz)  (((sz)+PGSIZE-1) & ~(PGSIZE-1))
 #define PGROUNDDOWN(a) (((a)) & ~(PGSIZE-1))
+#define HUGEROUNDUP(sz)  (((sz)+HUGEPGSIZE-1) & ~(HUGEPGSIZE-1))
+#define HUGEROUNDDOWN(a) (((a)) & ~(HUGEPGSIZE-1))
 
 // Page table/directory entry flags.
 #define PTE_P           0x001   // Present
@@ -99,11 +105,18 @@ struct segdesc {
 #define PTE_A           0x020   // Accessed
 #define PTE_D           0x040   // Dirty
 #define PTE_PS          0x080   // Page Size
+#define PTE_G           0x100   // Global, kept in the TLB across %cr3 loads
+#define PTE_COW         0x200   // Copy-on-write (software, one of the AVL bits)
+#define PTE_SWAP        0x400   // Swapped out, slot in PTE_ADDR (software, P clear)
 
 // Address in page table or page directory entry
 #define PTE_ADDR(pte)   ((uint)(pte) & ~0xFFF)
 #define PTE_FLAGS(pte)  ((uint)(pte) &  0xFFF)
 
+// Swap slot of a PTE_SWAP entry, and the entry for a slot
+#define PTE_SLOT(pte)   (PTE_ADDR(pte) >> PTXSHIFT)
+#define SWAPPTE(slot)   (((uint)(slot) << PTXSHIFT) | PTE_SWAP)
+
 #ifndef __ASSEMBLER__
 typedef uint pte_t;
 
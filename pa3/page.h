@@ -0,0 +1,11 @@
+struct page {
+  uint dev;
+  uint inum;         // 0 if the page caches nothing
+  uint pgno;         // page index within the file
+  int refcnt;        // users between pcget() and pcput()
+  char *data;        // kalloc'd; each mapping holds a kref()
+  struct page *hnext; // hash chain
+  struct page *prev; // LRU cache list
+  struct page *next;
+};
+
@@ -0,0 +1,210 @@
+// Page cache.
+//
+// The page cache holds the contents of regular files a page
+// at a time.  readi() reads whole pages through it,
+// writei() keeps it up to date, and MAP_SHARED mappings map its pages straight
+// into each process, so every reader and mapper of a file
+// sees the same copy.
+//
+// Interface:
+// * To get a page of a file, call pcget; pclookup returns
+//     it only if it is cached already.
+// * When done with the page, call pcput.
+// * A page table mapping a page holds a kref() on its data;
+//     the page is not recycled while any mapping remains.
+//
+// Callers hold the inode's lock, which serializes filling
+// and updating its pages.  pcache.lock protects the hash
+// chains, the LRU list and refcnt.  A page on a hash chain
+// always holds the file's data.
+
+#include "types.h"
+#include "defs.h"
+#include "param.h"
+#include "mmu.h"
+#include "spinlock.h"
+#include "waitq.h"
+#include "sleeplock.h"
+#include "fs.h"
+#include "file.h"
+#include "page.h"
+
+#define NPCHASH 61
+#define PCHASH(dev, inum, pgno) (((dev)*31 + (inum)*17 + (pgno)) % NPCHASH)
+
+struct {
+  struct spinlock lock;
+  struct page page[NPCACHE];
+  struct page *hash[NPCHASH];
+
+  // Linked list of all pages, through prev/next.
+  // head.next is most recently used.
+  struct page head;
+} pcache;
+
+void
+pcinit(void)
+{
+  struct page *pg;
+
+  initlock(&pcache.lock, "pcache");
+
+  pcache.head.prev = &pcache.head;
+  pcache.head.next = &pcache.head;
+  for(pg = pcache.page; pg < pcache.page+NPCACHE; pg++){
+    pg->next = pcache.head.next;
+    pg->prev = &pcache.head;
+    pcache.head.next->prev = pg;
+    pcache.head.next = pg;
+  }
+}
+
+// Find the cached page pgno of inode inum.
+// Caller holds pcache.lock.
+static struct page*
+pcfind(uint dev, uint inum, uint pgno)
+{
+  struct page *pg;
+
+  for(pg = pcache.hash[PCHASH(dev, inum, pgno)]; pg; pg = pg->hnext)
+    if(pg->dev == dev && pg->inum == inum && pg->pgno == pgno)
+      return pg;
+  return 0;
+}
+
+// Take pg off its hash chain; it caches nothing after.
+// Caller holds pcache.lock.
+static void
+pcunhash(struct page *pg)
+{
+  struct page **pp;
+
+  pp = &pcache.hash[PCHASH(pg->dev, pg->inum, pg->pgno)];
+  for(; *pp; pp = &(*pp)->hnext){
+    if(*pp == pg){
+      *pp = pg->hnext;
+      break;
+    }
+  }
+  pg->inum = 0;
+}
+
+// Return page pgno of ip if it is cached, or 0.
+// Caller must hold ip->lock.
+struct page*
+pclookup(struct inode *ip, uint pgno)
+{
+  struct page *pg;
+
+  acquire(&pcache.lock);
+  if((pg = pcfind(ip->dev, ip->inum, pgno)) != 0)
+    pg->refcnt++;
+  release(&pcache.lock);
+  return pg;
+}
+
+// Return page pgno of ip, reading it in if need be.
+// Returns 0 if every page is in use or mapped, or there is
+// no memory for it.
+// Caller must hold ip->lock.
+struct page*
+pcget(struct inode *ip, uint pgno)
+{
+  struct page *pg;
+
+  acquire(&pcache.lock);
+  if((pg = pcfind(ip->dev, ip->inum, pgno)) != 0){
+    pg->refcnt++;
+    release(&pcache.lock);
+    return pg;
+  }
+
+  // Not cached; recycle the least recently used page
+  // nobody is using or has mapped.
+  for(pg = pcache.head.prev; pg != &pcache.head; pg = pg->prev)
+    if(pg->refcnt == 0 && (pg->data == 0 || krefcount(pg->data) == 1))
+      break;
+  if(pg == &pcache.head){
+    release(&pcache.lock);
+    return 0;
+  }
+  if(pg->inum)
+    pcunhash(pg);
+  pg->dev = ip->dev;
+  pg->inum = ip->inum;
+  pg->pgno = pgno;
+  pg->refcnt = 1;
+  pg->hnext = pcache.hash[PCHASH(pg->dev, pg->inum, pgno)];
+  pcache.hash[PCHASH(pg->dev, pg->inum, pgno)] = pg;
+  release(&pcache.lock);
+
+  if(pg->data == 0 && (pg->data = kalloc()) == 0){
+    acquire(&pcache.lock);
+    pcunhash(pg);
+    pg->refcnt = 0;
+    release(&pcache.lock);
+    return 0;
+  }
+  ireadpage(ip, pgno, pg->data);
+  return pg;
+}
+
+// Release a page from pcget or pclookup.
+// Move to the head of the MRU list.
+void
+pcput(struct page *pg)
+{
+  acquire(&pcache.lock);
+  pg->refcnt--;
+  if(pg->refcnt == 0){
+    // no one is using it.
+    pg->next->prev = pg->prev;
+    pg->prev->next = pg->next;
+    pg->next = pcache.head.next;
+    pg->prev = &pcache.head;
+    pcache.head.next->prev = pg;
+    pcache.head.next = pg;
+  }
+  release(&pcache.lock);
+}
+
+// Copy n bytes written to ip at off into the cached
+// pages they land in.
+// Caller must hold ip->lock.
+void
+pcupdate(struct inode *ip, char *src, uint off, uint n)
+{
+  struct page *pg;
+  uint tot, m;
+
+  for(tot = 0; tot < n; tot += m, off += m, src += m){
+    m = PGSIZE - off%PGSIZE;
+    if(m > n - tot)
+      m = n - tot;
+    if((pg = pclookup(ip, off/PGSIZE)) != 0){
+      memmove(pg->data + off%PGSIZE, src, m);
+      pcput(pg);
+    }
+  }
+}
+
+// Drop all of ip's pages, because its blocks are being freed.
+// Caller must hold ip->lock.
+void
+pcinval(struct inode *ip)
+{
+  struct page *pg;
+
+  acquire(&pcache.lock);
+  for(pg = pcache.page; pg < pcache.page+NPCACHE; pg++){
+    if(pg->inum != ip->inum || pg->dev != ip->dev)
+      continue;
+    pcunhash(pg);
+    // Leave a still-mapped page to its mappers.
+    if(pg->data && krefcount(pg->data) > 1){
+      kfree(pg->data);
+      pg->data = 0;
+    }
+  }
+  release(&pcache.lock);
+}
@@ -1,18 +1,34 @@
-#define NPROC        64  // maximum number of processes
+#define NPROC      2048  // maximum number of processes
 #define KSTACKSIZE 4096  // size of per-process kernel stack
 #define NCPU          8  // maximum number of CPUs
 #define NOFILE       16  // open files per process
-#define NFILE       100  // open files per system
 #define NINODE       50  // maximum number of active i-nodes
 #define NDEV         10  // maximum major device number
 #define ROOTDEV       1  // device number of file system root disk
 #define MAXARG       32  // max exec arguments
 #define MAXOPBLOCKS  10  // max # of blocks any FS op writes
 #define LOGSIZE      (MAXOPBLOCKS*3)  // max data blocks in on-disk log
-#define NBUF         (MAXOPBLOCKS*3)  // size of disk block cache
+#define NBUF          128  // size of disk block cache
+#define NPCACHE       512  // size of file page cache
+#define MAXORDER       10  // largest kalloc_order() block is 2^10 pages
 #define FSSIZE       1000  // size of file system in blocks
+#define NSWAP        4096  // pages of swap space after the file system
+#define WAKEUPGRAN    100  // militicks a woken proc must lead by to preempt
+#define SLEEPCREDIT   300  // max militicks of vruntime credit on wakeup
+#define FAULTAROUND     4  // cached pages mapped after a file mmap fault
+#define RAMAX           4  // max mmap readahead window, in pages
+#define RECLAIMBATCH   32  // pages reclaim() frees when kalloc runs dry
 #define PROT_READ    0x1
 #define PROT_WRITE   0x2
 #define MAP_ANONYMOUS 0x1
 #define MAP_POPULATE 0x2
+#define MAP_SHARED   0x4
+#define MAP_HUGE     0x8
+#define MS_ASYNC     0x1
+#define MS_SYNC      0x2
+#define MADV_NORMAL     0
+#define MADV_RANDOM     1
+#define MADV_SEQUENTIAL 2
+#define MADV_WILLNEED   3
+#define MADV_DONTNEED   4
 
@@ -0,0 +1,51 @@
+// Page fault scaling benchmark.
+// Have 1, 2 and 4 processes at once each fault in 2MB of
+// anonymous memory, and report how long each round took.
+// Allocation should not slow down as processes are added.
+
+#include "param.h"
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+
+#define LEN  (2*1024*1024)
+
+void
+pfault(void)
+{
+  int nproc, i, j, start;
+  char *a;
+
+  for(nproc = 1; nproc <= 4; nproc *= 2){
+    start = uptime();
+    for(i = 0; i < nproc; i++){
+      int pid = fork();
+      if(pid < 0){
+        printf(1, "pfault: fork failed\n");
+        exit();
+      }
+      if(pid == 0){
+        a = (char*)mmap(0, LEN, PROT_READ|PROT_WRITE, MAP_ANONYMOUS, -1, 0);
+        if(a == 0){
+          printf(1, "pfault: mmap failed\n");
+          exit();
+        }
+        for(j = 0; j < LEN; j += 4096)
+          a[j] = 1;
+        munmap((uint)a);
+        exit();
+      }
+    }
+    for(i = 0; i < nproc; i++)
+      wait();
+    printf(1, "pfault: %d procs x %d pages in %d ticks\n",
+           nproc, LEN/4096, uptime() - start);
+  }
+}
+
+int
+main(void)
+{
+  pfault();
+  exit();
+}
@@ -0,0 +1,48 @@
+// Context switch benchmark.
+// Two processes bounce one byte back and forth over a pair
+// of pipes, so each round trip is two sleeps, two wakeups
+// and two context switches.  Report how long N rounds took.
+
+#include "param.h"
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+
+#define N  20000
+
+int
+main(void)
+{
+  int p[2], q[2], i, pid, start;
+  char c;
+
+  if(pipe(p) < 0 || pipe(q) < 0){
+    printf(1, "pingpong: pipe failed\n");
+    exit();
+  }
+  start = uptime();
+  pid = fork();
+  if(pid < 0){
+    printf(1, "pingpong: fork failed\n");
+    exit();
+  }
+  if(pid == 0){
+    for(i = 0; i < N; i++){
+      if(read(p[0], &c, 1) != 1)
+        break;
+      write(q[1], &c, 1);
+    }
+    exit();
+  }
+  c = 'x';
+  for(i = 0; i < N; i++){
+    write(p[1], &c, 1);
+    if(read(q[0], &c, 1) != 1){
+      printf(1, "pingpong: read failed\n");
+      break;
+    }
+  }
+  wait();
+  printf(1, "pingpong: %d round trips in %d ticks\n", N, uptime() - start);
+  exit();
+}
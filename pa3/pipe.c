@@ -2,23 +2,55 @@
 #include "defs.h"
 #include "param.h"
 #include "mmu.h"
+#include "rbtree.h"
 #include "proc.h"
 #include "fs.h"
 #include "spinlock.h"
+#include "slab.h"
+#include "waitq.h"
 #include "sleeplock.h"
 #include "file.h"
 
-#define PIPESIZE 512
+#define PIPESIZE PGSIZE
 
+// The ring is shared without p->lock.  Only the writer moves
+// nwrite and only the reader moves nread, each after copying
+// its data, so each side can see how much the other has left
+// it.  Writers are serialized among themselves by wlock and
+// readers by rlock, which are sleeplocks so that the copy may
+// fault.  Neither is held while sleeping on an empty or full
+// ring, so a second reader or writer waits there too, where
+// it can be killed.  p->lock is only taken for that sleep,
+// or to wake the other side when this side finds the ring
+// was empty or full and so the other may be asleep.
+//
+// A write of a whole, page-aligned page into an empty pipe
+// lends the page itself instead (see pageloan); it stands
+// for the PIPESIZE bytes of the stream from loanoff, and the
+// reader copies straight out of it and then drops it.
 struct pipe {
   struct spinlock lock;
-  char data[PIPESIZE];
-  uint nread;     // number of bytes read
-  uint nwrite;    // number of bytes written
+  char *data;     // the ring, one page
+  volatile uint nread;     // number of bytes read
+  volatile uint nwrite;    // number of bytes written
   int readopen;   // read fd is still open
   int writeopen;  // write fd is still open
+  struct waitq rwait;  // readers waiting for data
+  struct waitq wwait;  // writers waiting for room
+  struct sleeplock rlock;  // one reader at a time
+  struct sleeplock wlock;  // one writer at a time
+  char *loan;     // page lent by pipewrite, or 0
+  uint loanoff;   // stream offset of loan's first byte
 };
 
+static struct slabcache pipecache;
+
+void
+pipeinit(void)
+{
+  slabinit(&pipecache, "pipe", sizeof(struct pipe));
+}
+
 int
 pipealloc(struct file **f0, struct file **f1)
 {
@@ -28,13 +60,20 @@ pipealloc(struct file **f0, struct file **f1)
   *f0 = *f1 = 0;
   if((*f0 = filealloc()) == 0 || (*f1 = filealloc()) == 0)
     goto bad;
-  if((p = (struct pipe*)kalloc()) == 0)
+  if((p = (struct pipe*)slaballoc(&pipecache)) == 0)
     goto bad;
+  if((p->data = kalloc()) == 0)
+    goto bad;
+  p->loan = 0;
   p->readopen = 1;
   p->writeopen = 1;
   p->nwrite = 0;
   p->nread = 0;
   initlock(&p->lock, "pipe");
+  initwaitq(&p->rwait);
+  initwaitq(&p->wwait);
+  initsleeplock(&p->rlock, "piperead");
+  initsleeplock(&p->wlock, "pipewrite");
   (*f0)->type = FD_PIPE;
   (*f0)->readable = 1;
   (*f0)->writable = 0;
@@ -47,8 +86,11 @@ pipealloc(struct file **f0, struct file **f1)
 
 //PAGEBREAK: 20
  bad:
-  if(p)
-    kfree((char*)p);
+  if(p){
+    if(p->data)
+      kfree(p->data);
+    slabfree(&pipecache, p);
+  }
   if(*f0)
     fileclose(*f0);
   if(*f1)
@@ -62,60 +104,144 @@ pipeclose(struct pipe *p, int writable)
   acquire(&p->lock);
   if(writable){
     p->writeopen = 0;
-    wakeup(&p->nread);
+    wakeupq(&p->rwait);
   } else {
     p->readopen = 0;
-    wakeup(&p->nwrite);
+    wakeupq(&p->wwait);
   }
   if(p->readopen == 0 && p->writeopen == 0){
     release(&p->lock);
-    kfree((char*)p);
+    if(p->loan)
+      kfree(p->loan);
+    kfree(p->data);
+    slabfree(&pipecache, p);
   } else
     release(&p->lock);
 }
 
 //PAGEBREAK: 40
+// Copy n bytes from src into the ring at byte off, in two
+// pieces if they wrap around its end.
+static void
+ringput(struct pipe *p, uint off, char *src, uint n)
+{
+  uint i, m;
+
+  i = off % PIPESIZE;
+  m = PIPESIZE - i < n ? PIPESIZE - i : n;
+  memmove(p->data + i, src, m);
+  memmove(p->data, src + m, n - m);
+}
+
+// Copy n bytes from the ring at byte off to dst.
+static void
+ringget(struct pipe *p, uint off, char *dst, uint n)
+{
+  uint i, m;
+
+  i = off % PIPESIZE;
+  m = PIPESIZE - i < n ? PIPESIZE - i : n;
+  memmove(dst, p->data + i, m);
+  memmove(dst + m, p->data, n - m);
+}
+
 int
 pipewrite(struct pipe *p, char *addr, int n)
 {
+  uint r, w, m;
+  char *pg;
   int i;
 
-  acquire(&p->lock);
-  for(i = 0; i < n; i++){
-    while(p->nwrite == p->nread + PIPESIZE){  //DOC: pipewrite-full
-      if(p->readopen == 0 || myproc()->killed){
-        release(&p->lock);
-        return -1;
+  acquiresleep(&p->wlock);
+  for(i = 0; i < n; i += m){
+    w = p->nwrite;
+    m = PIPESIZE - (w - p->nread);
+    if(m == 0){
+      releasesleep(&p->wlock);
+      acquire(&p->lock);
+      while(p->nwrite == p->nread + PIPESIZE){  //DOC: pipewrite-full
+        if(p->readopen == 0 || myproc()->killed){
+          release(&p->lock);
+          return -1;
+        }
+        sleepq(&p->wwait, &p->lock);  //DOC: pipewrite-sleep
       }
-      wakeup(&p->nread);
-      sleep(&p->nwrite, &p->lock);  //DOC: pipewrite-sleep
+      release(&p->lock);
+      acquiresleep(&p->wlock);
+      continue;
+    }
+    if(m == PIPESIZE && p->loan == 0 && n - i >= PGSIZE &&
+       (uint)(addr + i) % PGSIZE == 0 && (pg = pageloan(addr + i)) != 0){
+      p->loan = pg;
+      p->loanoff = w;
+      __sync_synchronize();
+    } else {
+      if(m > n - i)
+        m = n - i;
+      ringput(p, w, addr + i, m);
+    }
+    p->nwrite = w + m;
+    // The reader publishes nread before it checks nwrite and
+    // sleeps, so if it has read up to where we started it
+    // may be asleep; otherwise it will see this data.
+    __sync_synchronize();
+    r = p->nread;
+    if(r == w){
+      acquire(&p->lock);
+      wakeupq(&p->rwait);  //DOC: pipewrite-wakeup1
+      release(&p->lock);
     }
-    p->data[p->nwrite++ % PIPESIZE] = addr[i];
   }
-  wakeup(&p->nread);  //DOC: pipewrite-wakeup1
-  release(&p->lock);
+  releasesleep(&p->wlock);
   return n;
 }
 
 int
 piperead(struct pipe *p, char *addr, int n)
 {
-  int i;
+  uint r, w, m;
 
-  acquire(&p->lock);
-  while(p->nread == p->nwrite && p->writeopen){  //DOC: pipe-empty
-    if(myproc()->killed){
-      release(&p->lock);
-      return -1;
+  for(;;){
+    acquire(&p->lock);
+    while(p->nread == p->nwrite && p->writeopen){  //DOC: pipe-empty
+      if(myproc()->killed){
+        release(&p->lock);
+        return -1;
+      }
+      sleepq(&p->rwait, &p->lock); //DOC: piperead-sleep
     }
-    sleep(&p->nread, &p->lock); //DOC: piperead-sleep
-  }
-  for(i = 0; i < n; i++){  //DOC: piperead-copy
-    if(p->nread == p->nwrite)
+    release(&p->lock);
+    acquiresleep(&p->rlock);
+    r = p->nread;
+    if(r != p->nwrite || !p->writeopen)
       break;
-    addr[i] = p->data[p->nread++ % PIPESIZE];
+    // Another reader took the data first.
+    releasesleep(&p->rlock);
+  }
+  m = p->nwrite - r;  //DOC: piperead-copy
+  if(m > n)
+    m = n;
+  __sync_synchronize();
+  if(p->loan && r - p->loanoff < PGSIZE){
+    if(m > p->loanoff + PGSIZE - r)
+      m = p->loanoff + PGSIZE - r;
+    memmove(addr, p->loan + (r - p->loanoff), m);
+    if(r + m == p->loanoff + PGSIZE){
+      kfree(p->loan);
+      p->loan = 0;
+      __sync_synchronize();
+    }
+  } else
+    ringget(p, r, addr, m);
+  p->nread = r + m;
+  // Likewise, if the ring was full the writer may be asleep.
+  __sync_synchronize();
+  w = p->nwrite;
+  if(w == r + PIPESIZE){
+    acquire(&p->lock);
+    wakeupq(&p->wwait);  //DOC: piperead-wakeup
+    release(&p->lock);
   }
-  wakeup(&p->nwrite);  //DOC: piperead-wakeup
-  release(&p->lock);
-  return i;
+  releasesleep(&p->rlock);
+  return m;
 }
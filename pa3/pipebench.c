@@ -0,0 +1,60 @@
+// Pipe throughput benchmark.
+// Stream 8MB through a pipe from a child to its parent with
+// writes of 16, 64, 256, 1024 and 4096 bytes, and report the
+// rate for each.  The last run writes whole page-aligned
+// pages, which pipewrite lends to the pipe without copying.
+
+#include "param.h"
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+
+#define TOTAL  (8*1024*1024)
+
+char buf[4096+1];  // writes go from buf+1, never page-aligned
+
+// Send TOTAL bytes in writes of sz bytes from wbuf and
+// print the rate.
+void
+run(char *wbuf, int sz, char *what)
+{
+  int fds[2], i, n, t;
+
+  if(pipe(fds) < 0){
+    printf(1, "pipebench: pipe failed\n");
+    exit();
+  }
+  t = uptime();
+  if(fork() == 0){
+    close(fds[0]);
+    for(i = 0; i < TOTAL/sz; i++)
+      write(fds[1], wbuf, sz);
+    exit();
+  }
+  close(fds[1]);
+  n = 0;
+  while((i = read(fds[0], buf, sizeof(buf))) > 0)
+    n += i;
+  t = uptime() - t;
+  wait();
+  close(fds[0]);
+  if(n != TOTAL)
+    printf(1, "pipebench: read %d bytes, wanted %d\n", n, TOTAL);
+  // 100 ticks a second
+  printf(1, "pipebench: %d byte%s writes: %d KB/s, %d MB/s\n", sz, what,
+         t ? (TOTAL/1024)*100/t : 0, t ? (TOTAL/(1024*1024))*100/t : 0);
+}
+
+int
+main(void)
+{
+  char *page;
+  int sz;
+
+  for(sz = 16; sz <= 4096; sz *= 4)
+    run(buf + 1, sz, "");
+  page = sbrk(2*4096);
+  page = (char*)(((uint)page + 4095) & ~4095);
+  run(page, 4096, " page-aligned");
+  exit();
+}
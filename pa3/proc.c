@@ -4,21 +4,65 @@
 #include "memlayout.h"
 #include "mmu.h"
 #include "x86.h"
+#include "traps.h"
+#include "rbtree.h"
 #include "proc.h"
 #include "spinlock.h"
+#include "waitq.h"
 #include "sleeplock.h"
 #include "fs.h"
 #include "file.h"
+#include "page.h"
+
+// The process table grows a page of proc slots at a time,
+// up to NPROC.  Slots are never given back; UNUSED ones sit
+// on a free stack, and live ones are hashed by pid.
+#define NPIDHASH 256
+#define PIDHASH(pid) ((uint)(pid) % NPIDHASH)
+#define PROCPERPAGE (PGSIZE / sizeof(struct proc))
 
 struct {
   struct spinlock lock;
-  struct proc proc[NPROC];
+  struct proc *all;                // every slot, linked by allnext
+  struct proc *free;               // UNUSED slots, linked by freenext
+  struct proc *pidhash[NPIDHASH];  // chains linked by hashnext
+  int nslot;                       // number of slots allocated
 } ptable;
 
-uint total_weight;
-uint vruntime_limit = 2147483647;//21 4748 3647
-int first = 1;
-struct mmap_area mma[64];
+// Per-cpu CFS run queue.  Holds the RUNNABLE processes
+// sorted by vruntime; the running process is not on the tree.
+//
+// rq->lock protects the tree and the state of the procs
+// on it, and is the lock held across swtch() into and out
+// of the cpu's scheduler.  It nests inside ptable.lock.
+// When two run queue locks are needed, take the one of the
+// lower-numbered cpu first.  p->cpu only changes with both
+// the old and the new run queue locked.
+struct rq {
+  struct spinlock lock;
+  struct rb_root tasks;
+  struct rb_node *leftmost;  // cached rb_first(&tasks)
+  uint load;                 // sum of weights of queued procs
+  int nr_running;            // number of queued procs
+  uint64 min_vruntime;       // never decreases; see update_min_vruntime
+  uint nr_migrations;        // procs moved here from another cpu
+  uint nr_steals;            // times this cpu stole from a busier one
+};
+
+static struct rq runqueues[NCPU];
+
+// sleep() and wakeup() hash their channel to one of these.
+#define NWAITQ 61
+#define WAITQHASH(chan) ((uint)(chan) % NWAITQ)
+static struct waitq waitqs[NWAITQ];
+
+// reclaim()'s clock hand: the next page it looks at is
+// clock.va in clock.p.  The lock keeps one reclaim at a time.
+static struct {
+  struct sleeplock lock;
+  struct proc *p;
+  uint va;
+} clock;
 
 int weight[40] = 
 {
@@ -33,17 +77,216 @@ int weight[40] =
 };
 
 static struct proc *initproc;
-int isFork = 0;
 int nextpid = 1;
 extern void forkret(void);
 extern void trapret(void);
 
-static void wakeup1(void *chan);
+static int vmadup(struct proc*, struct proc*);
 
 void
 pinit(void)
 {
+  int i;
+
   initlock(&ptable.lock, "ptable");
+  for(i = 0; i < NCPU; i++){
+    initlock(&runqueues[i].lock, "rq");
+    cpus[i].rq = &runqueues[i];
+  }
+  for(i = 0; i < NWAITQ; i++)
+    initwaitq(&waitqs[i]);
+  initsleeplock(&clock.lock, "reclaim");
+}
+
+// Lock and return this cpu's run queue.
+static struct rq*
+this_rq_lock(void)
+{
+  struct rq *rq;
+
+  pushcli();
+  rq = mycpu()->rq;
+  acquire(&rq->lock);
+  popcli();
+  return rq;
+}
+
+// Lock and return the run queue p is on, or last ran on.
+static struct rq*
+task_rq_lock(struct proc *p)
+{
+  struct rq *rq;
+
+  for(;;){
+    rq = cpus[p->cpu].rq;
+    acquire(&rq->lock);
+    if(rq == cpus[p->cpu].rq)
+      return rq;
+    release(&rq->lock);
+  }
+}
+
+// Is vruntime a before vruntime b?  Compares the signed
+// difference, so it stays right even if a counter wraps.
+static int
+vrbefore(uint64 a, uint64 b)
+{
+  return (long long)(a - b) < 0;
+}
+
+// Raise rq->min_vruntime to the smallest vruntime of the
+// procs on rq and curr, the process running on its cpu.
+// Caller must hold rq->lock.
+static void
+update_min_vruntime(struct rq *rq, struct proc *curr)
+{
+  uint64 vruntime = rq->min_vruntime;
+  struct proc *left;
+
+  if(curr)
+    vruntime = curr->vruntime;
+  if(rq->leftmost){
+    left = rb_entry(rq->leftmost, struct proc, rbnode);
+    if(curr == 0 || vrbefore(left->vruntime, vruntime))
+      vruntime = left->vruntime;
+  }
+  if(vrbefore(rq->min_vruntime, vruntime))
+    rq->min_vruntime = vruntime;
+}
+
+// Convert militicks to TSC cycles.
+static uint64
+mtcycles(uint mt)
+{
+  return divu64((uint64)tscpertick * mt, 1000);
+}
+
+// Charge the running process p for the TSC cycles it has run
+// since it was last charged.  The single place where runtime
+// and vruntime advance.  Caller must hold rq->lock.
+static void
+update_curr(struct rq *rq, struct proc *p)
+{
+  uint64 now = rdtsc();
+  uint64 delta = now - p->exec_start;
+
+  p->exec_start = now;
+  p->runtime += delta;
+  if(p->weight == 1024)
+    p->vruntime += delta;
+  else
+    p->vruntime += divu64(delta * 1024, p->weight);
+  update_min_vruntime(rq, p);
+}
+
+// Put RUNNABLE p on the run queue of cpu c.
+// Caller must hold c->rq->lock.
+static void
+enqueue(struct cpu *c, struct proc *p)
+{
+  struct rq *rq = c->rq;
+  struct rb_node **link = &rq->tasks.node;
+  struct rb_node *parent = 0;
+  int leftmost = 1;
+
+  if(!holding(&rq->lock) || p->onrq)
+    panic("enqueue");
+  while(*link){
+    parent = *link;
+    if(vrbefore(p->vruntime, rb_entry(parent, struct proc, rbnode)->vruntime))
+      link = &parent->left;
+    else {
+      link = &parent->right;
+      leftmost = 0;
+    }
+  }
+  rb_link(&p->rbnode, parent, link);
+  rb_insert(&p->rbnode, &rq->tasks);
+  if(leftmost)
+    rq->leftmost = &p->rbnode;
+  rq->load += p->weight;
+  rq->nr_running++;
+  p->onrq = 1;
+  if(p->cpu != c - cpus){
+    rq->nr_migrations++;
+    p->cpu = c - cpus;
+  }
+}
+
+// Take p off its cpu's run queue.
+// Caller must hold that run queue's lock.
+static void
+dequeue(struct proc *p)
+{
+  struct rq *rq = cpus[p->cpu].rq;
+
+  if(!holding(&rq->lock) || !p->onrq)
+    panic("dequeue");
+  if(rq->leftmost == &p->rbnode)
+    rq->leftmost = rb_next(&p->rbnode);
+  rb_erase(&p->rbnode, &rq->tasks);
+  rq->load -= p->weight;
+  rq->nr_running--;
+  p->onrq = 0;
+}
+
+// Find the least loaded cpu to start a new process on.
+static struct cpu*
+idlest_cpu(void)
+{
+  struct cpu *c, *best;
+  int load, bestload;
+
+  best = 0;
+  bestload = 0;
+  for(c = cpus; c < cpus+ncpu; c++){
+    load = c->rq->nr_running + (c->proc != 0);
+    if(best == 0 || load < bestload){
+      best = c;
+      bestload = load;
+    }
+  }
+  return best;
+}
+
+// Cpu c has nothing to run: move the process with the
+// smallest vruntime from the busiest other cpu onto c's
+// run queue.  Called and returns with c->rq->lock held,
+// but drops it in between to take the locks in order.
+static void
+steal(struct cpu *c)
+{
+  struct cpu *o, *busiest;
+  struct rq *first, *second;
+  struct proc *p;
+
+  busiest = 0;
+  for(o = cpus; o < cpus+ncpu; o++)
+    if(o != c && o->rq->nr_running > 0 &&
+       (busiest == 0 || o->rq->nr_running > busiest->rq->nr_running))
+      busiest = o;
+  if(busiest == 0)
+    return;
+
+  release(&c->rq->lock);
+  if(c < busiest){
+    first = c->rq;
+    second = busiest->rq;
+  } else {
+    first = busiest->rq;
+    second = c->rq;
+  }
+  acquire(&first->lock);
+  acquire(&second->lock);
+  if(c->rq->leftmost == 0 && busiest->rq->leftmost){
+    p = rb_entry(busiest->rq->leftmost, struct proc, rbnode);
+    dequeue(p);
+    // Keep its lag relative to the new cpu's min_vruntime.
+    p->vruntime = p->vruntime - busiest->rq->min_vruntime + c->rq->min_vruntime;
+    enqueue(c, p);
+    c->rq->nr_steals++;
+  }
+  release(&busiest->rq->lock);
 }
 
 // Must be called with interrupts disabled
@@ -85,9 +328,63 @@ myproc(void) {
   return p;
 }
 
+// Add a page of UNUSED slots to the process table.
+// Returns 0 if the table is full or memory is short.
+// Caller must hold ptable.lock.
+static int
+growptable(void)
+{
+  struct proc *p;
+  char *mem;
+  int i;
+
+  if(ptable.nslot + PROCPERPAGE > NPROC)
+    return 0;
+  if((mem = kalloc()) == 0)
+    return 0;
+  memset(mem, 0, PGSIZE);
+  for(i = 0; i < PROCPERPAGE; i++){
+    p = (struct proc*)mem + i;
+    p->allnext = ptable.all;
+    ptable.all = p;
+    p->freenext = ptable.free;
+    ptable.free = p;
+  }
+  ptable.nslot += PROCPERPAGE;
+  return 1;
+}
+
+// Return the live process with the given pid, or 0.
+// Caller must hold ptable.lock.
+static struct proc*
+findproc(int pid)
+{
+  struct proc *p;
+
+  for(p = ptable.pidhash[PIDHASH(pid)]; p; p = p->hashnext)
+    if(p->pid == pid)
+      return p;
+  return 0;
+}
+
+// Return p to the free stack.  Caller must hold ptable.lock.
+static void
+freeproc(struct proc *p)
+{
+  struct proc **pp;
+
+  for(pp = &ptable.pidhash[PIDHASH(p->pid)]; *pp != p; pp = &(*pp)->hashnext)
+    ;
+  *pp = p->hashnext;
+  p->pid = 0;
+  p->state = UNUSED;
+  p->freenext = ptable.free;
+  ptable.free = p;
+}
+
 //PAGEBREAK: 32
-// Look in the process table for an UNUSED proc.
-// If found, change state to EMBRYO and initialize
+// Take an UNUSED proc off the free stack.
+// If there is one, change state to EMBRYO and initialize
 // state required to run in the kernel.
 // Otherwise return 0.
 static struct proc*
@@ -98,29 +395,37 @@ allocproc(void)
 
   acquire(&ptable.lock);
 
-  for(p = ptable.proc; p < &ptable.proc[NPROC]; p++)
-    if(p->state == UNUSED)
-      goto found;
-
-  release(&ptable.lock);
-  return 0;
+  if(ptable.free == 0 && !growptable()){
+    release(&ptable.lock);
+    return 0;
+  }
+  p = ptable.free;
+  ptable.free = p->freenext;
 
-found:
   p->state = EMBRYO;
   p->pid = nextpid++;
+  p->hashnext = ptable.pidhash[PIDHASH(p->pid)];
+  ptable.pidhash[PIDHASH(p->pid)] = p;
   p->nice = 20;
   p->weight = 1024;
   p->start = ticks;
   p->runtime = 0;
-  p->vrunIndex = 0;
-  p->progress = 0;
   p->vruntime = 0;
+  p->onrq = 0;
+  p->lastcpu = 0;
+  p->vmas.node = 0;
+  p->vmacache = 0;
+  p->vmbusy = 0;
+  p->minflt = 0;
+  p->majflt = 0;
 
   release(&ptable.lock);
 
   // Allocate kernel stack.
   if((p->kstack = kalloc()) == 0){
-    p->state = UNUSED;
+    acquire(&ptable.lock);
+    freeproc(p);
+    release(&ptable.lock);
     return 0;
   }
   sp = p->kstack + KSTACKSIZE;
@@ -173,11 +478,12 @@ userinit(void)
   // run this process. the acquire forces the above
   // writes to be visible, and the lock is also needed
   // because the assignment might not be atomic.
-  acquire(&ptable.lock);
+  acquire(&cpus[0].rq->lock);
 
   p->state = RUNNABLE;
+  enqueue(&cpus[0], p);
 
-  release(&ptable.lock);
+  release(&cpus[0].rq->lock);
 }
 
 // Grow current process's memory by n bytes.
@@ -197,7 +503,7 @@ growproc(int n)
       return -1;
   }
   curproc->sz = sz;
-  switchuvm(curproc);
+  lcr3(V2P(curproc->pgdir));  // flush the dropped pages' TLB entries
   return 0;
 }
 
@@ -210,6 +516,8 @@ fork(void)
   int i, pid;
   struct proc *np;
   struct proc *curproc = myproc();
+  struct cpu *c;
+  struct rq *rq;
 
   // Allocate process.
   if((np = allocproc()) == 0){
@@ -217,16 +525,34 @@ fork(void)
   }
 
   // Copy process state from proc.
-  if((np->pgdir = copyuvm(curproc->pgdir, curproc->sz)) == 0){
+#ifdef NOCOW
+  np->pgdir = copypage(curproc->pgdir, curproc->sz);
+#else
+  np->pgdir = copyuvm(curproc->pgdir, curproc->sz);
+#endif
+  if(np->pgdir == 0){
     kfree(np->kstack);
     np->kstack = 0;
-    np->state = UNUSED;
+    acquire(&ptable.lock);
+    freeproc(np);
+    release(&ptable.lock);
     return -1;
   }
+  curproc->vmbusy++;
+  if(vmadup(np, curproc) < 0){
+    vmafreeall(np);
+    curproc->vmbusy--;
+    freevm(np->pgdir);
+    kfree(np->kstack);
+    np->kstack = 0;
+    acquire(&ptable.lock);
+    freeproc(np);
+    release(&ptable.lock);
+    return -1;
+  }
+  curproc->vmbusy--;
   np->sz = curproc->sz;
   np->parent = curproc;
-  np->vruntime = curproc->vruntime;
-  np->vrunIndex = curproc->vrunIndex;
   *np->tf = *curproc->tf;
   //cprintf("parent: %d vrun: %d child: %d vrun: %d\n", curproc->pid, curproc->vruntime[0], np->pid, np->vruntime[0]);
 
@@ -240,95 +566,25 @@ fork(void)
 
   safestrcpy(np->name, curproc->name, sizeof(curproc->name));
   
-  if(first){
-    for(int i=0; i<64; i++){
-      mma[i].proc = 0; mma[i].addr = 0;
-      mma[i].offset = 0;
-      mma[i].f = 0;
-      mma[i].flags = 0;
-      mma[i].length = 0;
-      mma[i].prot = 0;
-      mma[i].valid = -1;
-    }
-    first = 0;
-  }
-
-  int j;
-  for(i=0; i<64; i++)
-    if(mma[i].proc == curproc && (mma[i].valid != -1)){
-      //isFork = np->pid;
-      //mmap(mma[i].addr - 0x40000000, mma[i].length, mma[i].prot, mma[i].flags, mma[i].fd, mma[i].offset);
-      for(j=0; j<64; j++) if(mma[j].valid==-1) break;
-      mma[j].addr = mma[i].addr;
-      mma[j].f = mma[i].f;
-      mma[j].flags = mma[i].flags;
-      mma[j].length = mma[i].length;
-      mma[j].offset = mma[i].offset;
-      mma[j].proc = np;
-      mma[j].prot = mma[i].prot;
-      mma[j].valid = mma[i].valid;
-
-      int flags = mma[j].flags;
-      int offset = mma[j].offset;
-      int cur, length = mma[j].length;
-      uint addr = mma[j].addr;
-      int prot = mma[j].prot;
-      struct proc *p = mma[j].proc;
-      struct file *f = mma[j].f;
-      int valid = mma[j].valid;
-      char *mem = 0;
-
-      //other flags don't have to do anything
-      if(flags == 2 || (flags==0 && valid==1)){//file-mapped and populate
-        uint original = f->off;
-        f->off = offset;
-        //int r;
-        for(cur=0; cur<length; cur+=PGSIZE){
-          mem = kalloc();
-          //cprintf("%d\n",freememCount());
-          //cprintf("constructed %x\n", V2P(mem));
-          if(mem==0) return 0;
-          memset(mem, 0, PGSIZE);
-          //physical page allocate
-	int org = f->off;
-	f->off = mma[j].offset;
-          fileread(f, mem, PGSIZE);
-          f->off = org;
-          //cprintf("%s\n", mem);
-          if(mappages(p->pgdir, (void*)(addr + cur), PGSIZE, V2P(mem), prot|PTE_U)==-1)
-            return 0;
-        //pte is created, new physical page and mmaped region is paired;
-        }
-        mma[i].valid = 1;
-        f->off = original;
-      }
-      else if(flags == 3 || (flags==1 && valid==1)){//anonymous and populate
-        //cprintf("Fourth should pass here\n");
-        f->off = offset;
-        //int r;
-        for(cur=0; cur<length; cur+=PGSIZE){
-          mem = kalloc();
-          //cprintf("%d\n",freememCount());
-          //cprintf("addr: %x\n", (uint)mem);
-          if(mem==0) return 0;
-          memset(mem, 0, PGSIZE);
-          //physical page allocate
-          
-          //cprintf("%s\n", mem);
-          if(mappages(p->pgdir, (void*)(addr + cur), PGSIZE, V2P(mem), prot|PTE_U)==-1)
-            return 0;
-        //pte is created, new physical page and mmaped region is paired;
-        }
-        mma[i].valid = 1;
-      }
-    }
-
   pid = np->pid;
 
+  // Start the child on the least loaded cpu, as far from
+  // that cpu's min_vruntime as the parent is from ours.
+  // Hold ptable.lock so that reclaim() never sees np
+  // RUNNABLE with np->cpu not yet naming its run queue.
+  rq = this_rq_lock();
+  np->vruntime = curproc->vruntime - rq->min_vruntime;
+  release(&rq->lock);
   acquire(&ptable.lock);
+  np->cpu = curproc->cpu;
+  c = idlest_cpu();
+  acquire(&c->rq->lock);
+  np->vruntime += c->rq->min_vruntime;
 
   np->state = RUNNABLE;
+  enqueue(c, np);
 
+  release(&c->rq->lock);
   release(&ptable.lock);
 
   return pid;
@@ -342,6 +598,7 @@ exit(void)
 {
   struct proc *curproc = myproc();
   struct proc *p;
+  struct rq *rq;
   int fd;
 
   if(curproc == initproc)
@@ -354,6 +611,12 @@ exit(void)
       curproc->ofile[fd] = 0;
     }
   }
+
+  // Drop mmap regions, writing back shared ones.  Their
+  // pages go with the page table when wait() frees it.
+  curproc->vmbusy++;
+  vmaflushall(curproc);
+  vmafreeall(curproc);
   
   begin_op();
   iput(curproc->cwd);
@@ -363,32 +626,24 @@ exit(void)
   acquire(&ptable.lock);
 
   // Parent might be sleeping in wait().
-  wakeup1(curproc->parent);
+  wakeup(curproc->parent);
 
   // Pass abandoned children to init.
-  for(p = ptable.proc; p < &ptable.proc[NPROC]; p++){
+  for(p = ptable.all; p; p = p->allnext){
     if(p->parent == curproc){
       p->parent = initproc;
       if(p->state == ZOMBIE)
-        wakeup1(initproc);
+        wakeup(initproc);
     }
   }
   
-  curproc->runtime += curproc->progress;
-  int flag = 0; int remind = 0, temp;
-  if(curproc->vruntime + curproc->progress * 1024 / curproc->weight < 0) flag = 1;
-  if(flag){
-    temp = curproc->vruntime - vruntime_limit;
-    remind = temp + curproc->progress * 1024 / curproc->weight;
-    curproc->vrunIndex++;
-    curproc->vruntime = remind;
-  }
-  else curproc->vruntime += curproc->progress * 1024 / curproc->weight;
-  curproc->progress = 0;
-  //cprintf("%d exit vruntime %d\n", curproc->pid, curproc->vruntime[0]);
-  total_weight = 0;
   // Jump into the scheduler, never to return.
+  // wait() can see ZOMBIE only once ptable.lock is released,
+  // and then takes our run queue lock before freeing the stack.
+  rq = this_rq_lock();
+  update_curr(rq, curproc);
   curproc->state = ZOMBIE;
+  release(&ptable.lock);
   sched();
   panic("zombie exit");
 }
@@ -401,26 +656,28 @@ wait(void)
   struct proc *p;
   int havekids, pid;
   struct proc *curproc = myproc();
+  struct rq *rq;
   
   acquire(&ptable.lock);
   for(;;){
     // Scan through table looking for exited children.
     havekids = 0;
-    for(p = ptable.proc; p < &ptable.proc[NPROC]; p++){
+    for(p = ptable.all; p; p = p->allnext){
       if(p->parent != curproc)
         continue;
       havekids = 1;
       if(p->state == ZOMBIE){
-        // Found one.
+        // Found one.  Make sure it is off its cpu's stack.
+        rq = task_rq_lock(p);
+        release(&rq->lock);
         pid = p->pid;
         kfree(p->kstack);
         p->kstack = 0;
         freevm(p->pgdir);
-        p->pid = 0;
         p->parent = 0;
         p->name[0] = 0;
         p->killed = 0;
-        p->state = UNUSED;
+        freeproc(p);
         release(&ptable.lock);
         return pid;
       }
@@ -432,7 +689,7 @@ wait(void)
       return -1;
     }
 
-    // Wait for children to exit.  (See wakeup1 call in proc_exit.)
+    // Wait for children to exit.  (See wakeup call in proc_exit.)
     sleep(curproc, &ptable.lock);  //DOC: wait-sleep
   }
 }
@@ -449,56 +706,73 @@ void
 scheduler(void)
 {
   struct proc *p;
-  struct proc *min;
   struct cpu *c = mycpu();
+  struct rq *rq = c->rq;
+  uint total_weight;
+  int idle;
 
   c->proc = 0;
+  c->nexttick = rdtsc() + tscpertick;
 
   for(;;){
     // Enable interrupts on this processor.
     sti();
-    
-    total_weight = 0;
 
-    acquire(&ptable.lock);
-    // Loop over process table looking for process to run.
-    for(p = ptable.proc; p < &ptable.proc[NPROC]; p++){
-      if(p->state != RUNNABLE) continue;
-      min = p;
-
-      for(p = ptable.proc; p < &ptable.proc[NPROC]; p++){
-        if(p->state == RUNNABLE) total_weight += weight[p->nice];
-        if(p->state == RUNNABLE && p->vrunIndex <= min->vrunIndex) {
-          if(p->vruntime < min->vruntime) min = p;
-        }
-      }
-      p = min;
-      
+    acquire(&rq->lock);
+    if(rq->leftmost == 0)
+      steal(c);
+    idle = rq->leftmost == 0;
+    // The leftmost queued process has the smallest vruntime.
+    if(rq->leftmost){
+      p = rb_entry(rq->leftmost, struct proc, rbnode);
+      total_weight = rq->load;
+      dequeue(p);
+      update_min_vruntime(rq, p);
+      c->need_resched = 0;
+
       // Switch to chosen process.  It is the process's job
-      // to release ptable.lock and then reacquire it
+      // to release rq->lock and then reacquire it
       // before jumping back to us.
-      
       c->proc = p;
       switchuvm(p);
 
+      // A slice is its weight's share of ten ticks.  trap()
+      // preempts it once the TSC passes slice_end.
       p->state = RUNNING;
-      p->allocated = 10000 * p->weight / total_weight; // total timeslice: 10000 militicks
+      p->exec_start = rdtsc();
+      p->slice_end = p->exec_start +
+        divu64((uint64)tscpertick * 10 * p->weight, total_weight);
+      timerarm();
 
-      //cprintf("weight: %d total: %d pid: %d vruntime: %d ticks: %d allocated: %d\n", p->weight, total_weight, p->pid, p->vruntime, p->progress, p->allocated);
       swtch(&(c->scheduler), p->context);
-      switchkvm();
       // Process is done running for now.
       // It should have changed its p->state before coming back.
       c->proc = 0;
-      
+      // Leave p's page table loaded so that if p runs here
+      // next there is no %cr3 reload, unless p has exited
+      // and wait() may free it once we release rq->lock.
+      if(p->state == ZOMBIE){
+        switchkvm();
+        c->pgdir = 0;
+      }
+    }
+    release(&rq->lock);
+
+    // Nothing to run: zero a free page for kalloc_zeroed().
+    if(idle){
+      if(c->droppgdir){
+        switchkvm();
+        c->pgdir = 0;
+        c->droppgdir = 0;
+        freevmdeferred();
+      }
+      kzero();
     }
-    release(&ptable.lock);
-
   }
 }
 
-// Enter scheduler.  Must hold only ptable.lock
-// and have changed proc->state. Saves and restores
+// Enter scheduler.  Must hold only this cpu's run queue
+// lock and have changed proc->state. Saves and restores
 // intena because intena is a property of this
 // kernel thread, not this CPU. It should
 // be proc->intena and proc->ncli, but that would
@@ -510,8 +784,8 @@ sched(void)
   int intena;
   struct proc *p = myproc();
 
-  if(!holding(&ptable.lock))
-    panic("sched ptable.lock");
+  if(!holding(&mycpu()->rq->lock))
+    panic("sched rq->lock");
   if(mycpu()->ncli != 1)
     panic("sched locks");
   if(p->state == RUNNING)
@@ -527,23 +801,15 @@ sched(void)
 void
 yield(void)
 {
-  acquire(&ptable.lock);  //DOC: yieldlock
-  myproc()->runtime += myproc()->progress;
-  int flag = 0; int remind = 0, temp;
-  if(vruntime_limit - myproc()->vruntime < myproc()->progress * 1024 / myproc()->weight) flag = 1;
-  if(flag){
-    temp = myproc()->vruntime - vruntime_limit;
-    remind = temp + myproc()->progress * 1024 / myproc()->weight;
-    myproc()->vrunIndex++;
-    myproc()->vruntime = remind;
-  }
-  else myproc()->vruntime += myproc()->progress * 1024 / myproc()->weight;
-  myproc()->progress = 0;
-  //cprintf("%d yield vruntime: %d index: %d\n", myproc()->pid, myproc()->vruntime[myproc()->vrunIndex], myproc()->vrunIndex);
-  total_weight = 0;
+  struct rq *rq = this_rq_lock();  //DOC: yieldlock
+
+  update_curr(rq, myproc());
   myproc()->state = RUNNABLE;
+  enqueue(mycpu(), myproc());
   sched();
-  release(&ptable.lock);
+  // We may have been stolen by another cpu.
+  rq = mycpu()->rq;
+  release(&rq->lock);
 }
 
 // A fork child's very first scheduling by scheduler()
@@ -552,8 +818,8 @@ void
 forkret(void)
 {
   static int first = 1;
-  // Still holding ptable.lock from scheduler.
-  release(&ptable.lock);
+  // Still holding rq->lock from scheduler.
+  release(&mycpu()->rq->lock);
 
   if (first) {
     // Some initialization functions must be run in the context
@@ -562,17 +828,27 @@ forkret(void)
     first = 0;
     iinit(ROOTDEV);
     initlog(ROOTDEV);
+    swapinit(ROOTDEV);
   }
 
   // Return to "caller", actually trapret (see allocproc).
 }
 
-// Atomically release lock and sleep on chan.
-// Reacquires lock when awakened.
 void
-sleep(void *chan, struct spinlock *lk)
+initwaitq(struct waitq *wq)
+{
+  initlock(&wq->lock, "waitq");
+  wq->head = 0;
+}
+
+// Atomically release lock and sleep on chan, queued on wq.
+// Reacquires lock when awakened.
+static void
+sleep1(struct waitq *wq, void *chan, struct spinlock *lk)
 {
   struct proc *p = myproc();
+  struct proc **pp;
+  struct rq *rq;
   
   if(p == 0)
     panic("sleep");
@@ -580,89 +856,153 @@ sleep(void *chan, struct spinlock *lk)
   if(lk == 0)
     panic("sleep without lk");
 
-  // Must acquire ptable.lock in order to
-  // change p->state and then call sched.
-  // Once we hold ptable.lock, we can be
+  // Once we hold wq->lock, we can be
   // guaranteed that we won't miss any wakeup
-  // (wakeup runs with ptable.lock locked),
+  // (wakeup runs with wq->lock locked),
   // so it's okay to release lk.
-  if(lk != &ptable.lock){  //DOC: sleeplock0
-    acquire(&ptable.lock);  //DOC: sleeplock1
-    release(lk);
-  }
-  p->runtime += p->progress;
-  int flag = 0; int remind = 0, temp;
-  if(vruntime_limit - p->vruntime < p->progress * 1024 / p->weight) flag = 1;
-  if(flag){
-    temp = p->vruntime - vruntime_limit;
-    remind = temp + p->progress * 1024 / p->weight;
-    p->vrunIndex++;
-    p->vruntime = remind;
-  }
-  else p->vruntime += p->progress * 1024 / p->weight;
-  p->progress = 0;
-  //cprintf("%d sleep vruntime: %d\n", p->pid, p->vruntime[0]);
-  total_weight = 0;
-  // Go to sleep.
+  acquire(&wq->lock);
+  release(lk);
   p->chan = chan;
+  p->wq = wq;
+  p->wqnext = wq->head;
+  wq->head = p;
+
+  // Go to sleep.  A wakeup that finds us SLEEPING
+  // waits for our run queue lock, so it cannot put us
+  // back on a run queue before sched() has switched away.
+  rq = this_rq_lock();
+  update_curr(rq, p);
   p->state = SLEEPING;
+  release(&wq->lock);
 
   sched();
 
-  // Tidy up.
+  release(&mycpu()->rq->lock);
+
+  // Tidy up.  wakeup unlinked us before making us RUNNABLE;
+  // kill did not.
+  if(p->wq){
+    acquire(&wq->lock);
+    for(pp = &wq->head; *pp != p; pp = &(*pp)->wqnext)
+      ;
+    *pp = p->wqnext;
+    p->wq = 0;
+    release(&wq->lock);
+  }
   p->chan = 0;
 
   // Reacquire original lock.
-  if(lk != &ptable.lock){  //DOC: sleeplock2
-    release(&ptable.lock);
-    acquire(lk);
-  }
+  acquire(lk);
 }
 
-//PAGEBREAK!
-// Wake up all processes sleeping on chan.
-// The ptable lock must be held.
+void
+sleep(void *chan, struct spinlock *lk)
+{
+  sleep1(&waitqs[WAITQHASH(chan)], chan, lk);
+}
+
+// Sleep on a wait queue embedded in the object it guards.
+void
+sleepq(struct waitq *wq, struct spinlock *lk)
+{
+  sleep1(wq, wq, lk);
+}
+
+// Has a wakeup asked this cpu to pick a new process?
+int
+needresched(void)
+{
+  int r;
+
+  pushcli();
+  r = mycpu()->need_resched;
+  popcli();
+  return r;
+}
+
+// p has just been woken onto cpu c.  Preempt the process
+// running there if p is more than WAKEUPGRAN behind it in
+// vruntime; another cpu is told with a reschedule IPI.
+// Caller must hold c->rq->lock.
 static void
-wakeup1(void *chan)
+check_preempt(struct cpu *c, struct proc *p)
 {
-  struct proc *p;
-  uint min=0, minindex = 0;
+  struct proc *curr = c->proc;
+
+  if(curr == 0 || curr->state != RUNNING)
+    return;
+  // Only c's own TSC may charge curr; another cpu's clock
+  // can be skewed against curr->exec_start.  A remote curr
+  // is judged by the vruntime its cpu last accounted.
+  if(c == mycpu())
+    update_curr(c->rq, curr);
+  if(!vrbefore(p->vruntime + mtcycles(WAKEUPGRAN), curr->vruntime))
+    return;
+  c->need_resched = 1;
+  if(c != mycpu())
+    lapicipi(c->apicid, T_IRQ0 + IRQ_RESCHED);
+}
 
-  for(p = ptable.proc; p < &ptable.proc[NPROC]; p++){
-    if(p->state == RUNNABLE) {
-      minindex = p->vrunIndex;
-      break;
-    }
-  }
-  
-  for(p = ptable.proc; p < &ptable.proc[NPROC]; p++){
-    if(p->state == RUNNABLE){
-      if(p->vrunIndex < minindex){
-        minindex = p->vrunIndex;
-        min = p->vruntime;
-      }
-    }
-  }
+// Make the SLEEPING process p RUNNABLE on the cpu it last
+// ran on.  Caller must hold that cpu's run queue lock, rq.
+static void
+wakeproc(struct rq *rq, struct proc *p)
+{
+  uint64 vruntime;
+
+  // Credit a sleeper up to SLEEPCREDIT below the
+  // min_vruntime of the cpu it last ran on, so it runs
+  // soon.  Never move it back, so that sleeping longer
+  // does not bank more credit than that.
+  vruntime = rq->min_vruntime - mtcycles(SLEEPCREDIT);
+  if(vrbefore(p->vruntime, vruntime))
+    p->vruntime = vruntime;
+  p->state = RUNNABLE;
+  p->parse = ticks;
+  enqueue(&cpus[p->cpu], p);
+  check_preempt(&cpus[p->cpu], p);
+}
 
-  for(p = ptable.proc; p < &ptable.proc[NPROC]; p++){
-    if(p->state == SLEEPING && p->chan == chan){
-      p->state = RUNNABLE;
-      p->parse = ticks;
-      p->vrunIndex = minindex;
-      p->vruntime = min;
+//PAGEBREAK!
+// Wake up all processes sleeping on chan in wq.
+// Only the sleepers queued on wq are looked at.
+static void
+wakeup1(struct waitq *wq, void *chan)
+{
+  struct proc *p, **pp;
+  struct rq *rq;
+
+  acquire(&wq->lock);
+  pp = &wq->head;
+  while((p = *pp) != 0){
+    if(p->chan != chan){
+      pp = &p->wqnext;
+      continue;
     }
+    rq = task_rq_lock(p);
+    if(p->state == SLEEPING){
+      *pp = p->wqnext;
+      p->wq = 0;
+      wakeproc(rq, p);
+    } else
+      pp = &p->wqnext;
+    release(&rq->lock);
   }
-
-
+  release(&wq->lock);
 }
 
 // Wake up all processes sleeping on chan.
 void
 wakeup(void *chan)
 {
-  acquire(&ptable.lock);
-  wakeup1(chan);
-  release(&ptable.lock);
+  wakeup1(&waitqs[WAITQHASH(chan)], chan);
+}
+
+// Wake up all processes sleeping on wq.
+void
+wakeupq(struct waitq *wq)
+{
+  wakeup1(wq, wq);
 }
 
 // Kill the process with the given pid.
@@ -672,20 +1012,22 @@ int
 kill(int pid)
 {
   struct proc *p;
+  struct rq *rq;
 
   acquire(&ptable.lock);
-  for(p = ptable.proc; p < &ptable.proc[NPROC]; p++){
-    if(p->pid == pid){
-      p->killed = 1;
-      // Wake process from sleep if necessary.
-      if(p->state == SLEEPING)
-        p->state = RUNNABLE;
-      release(&ptable.lock);
-      return 0;
-    }
+  if((p = findproc(pid)) == 0){
+    release(&ptable.lock);
+    return -1;
   }
+  p->killed = 1;
+  // Wake process from sleep if necessary.
+  // It takes itself off its wait queue.
+  rq = task_rq_lock(p);
+  if(p->state == SLEEPING)
+    wakeproc(rq, p);
+  release(&rq->lock);
   release(&ptable.lock);
-  return -1;
+  return 0;
 }
 
 //PAGEBREAK: 36
@@ -708,7 +1050,7 @@ procdump(void)
   char *state;
   uint pc[10];
 
-  for(p = ptable.proc; p < &ptable.proc[NPROC]; p++){
+  for(p = ptable.all; p; p = p->allnext){
     if(p->state == UNUSED)
       continue;
     if(p->state >= 0 && p->state < NELEM(states) && states[p->state])
@@ -730,32 +1072,58 @@ int getnice(int pid){
   int result;
 
   acquire(&ptable.lock);
-  for(p = ptable.proc; p < &ptable.proc[NPROC]; p++){
-    if(p->pid == pid){
-      result = p->nice;
-      release(&ptable.lock);
-      return result;
-    }
+  if((p = findproc(pid)) == 0){
+    release(&ptable.lock);
+    return -1;
+  }
+  result = p->nice;
+  release(&ptable.lock);
+  return result;
+}
+
+// Copy pid's minor and major page fault counts to
+// counts[0] and counts[1].
+int getfaults(int pid, uint *counts){
+  struct proc *p;
+  uint minflt, majflt;
+
+  acquire(&ptable.lock);
+  if((p = findproc(pid)) == 0){
+    release(&ptable.lock);
+    return -1;
   }
+  minflt = p->minflt;
+  majflt = p->majflt;
   release(&ptable.lock);
-  return -1;
+  // counts is user memory; a store to it may fault.
+  counts[0] = minflt;
+  counts[1] = majflt;
+  return 0;
 }
 
 int setnice(int pid, int value){
   struct proc *p;
+  struct rq *rq;
   if(value < 0 || value > 39) return -1;
   acquire(&ptable.lock);
-  for(p = ptable.proc; p < &ptable.proc[NPROC]; p++){
-    if(p->pid == pid){
-      p->nice = value;
-      p->weight = 1; // for overflow testing
-      //p->weight = weight[value];
-      release(&ptable.lock);
-      return 0;
-    }
+  if((p = findproc(pid)) == 0){
+    release(&ptable.lock);
+    return -1;
+  }
+  // The run queue load is the sum of queued weights.
+  rq = task_rq_lock(p);
+  if(p->onrq){
+    dequeue(p);
+    p->nice = value;
+    p->weight = weight[value];
+    enqueue(&cpus[p->cpu], p);
+  } else {
+    p->nice = value;
+    p->weight = weight[value];
   }
+  release(&rq->lock);
   release(&ptable.lock);
-  return -1;
+  return 0;
 }
 
 void padding1(int length, int num){
@@ -764,55 +1132,27 @@ void padding1(int length, int num){
   for(i=0; i < length - digit; i++) cprintf(" ");
 }
 
-void padding3(int length, struct proc *p){
-  int i = 0, digit = 10, j;
-  int temp;
-  int carry, cur = 1, next = 0;
-  int max[10]= {2, 1, 4, 7, 4, 8, 3, 6, 4, 7};
-  //cprintf("pass\n");
-  while(i<10){
-    carry = 0;
-    if(i>=1) cur *= 10;
-    for(j=0; j<p->vrunIndex; j++)
-      carry += max[9-i];
-    if(i<9)
-      carry += (p->vruntime - ((p->vruntime / (cur * 10)) * cur * 10)) / cur;
-    else if(i==9) carry += p->vruntime / 1000000000;
-
-    carry += next;
-    next = carry / 10;
-    i++;
-  }
-  if(next>=1) digit++;
-  for(i=0, temp = next; temp>=10; temp/=10, digit++);
-  
-  //cprintf("\ndigit: %d\n", digit);
-  // for(i=0; i<=p->vrunIndex; i++){
-  //   cprintf("%d\n", p->vruntime[i]);
-  // }
-  cur = 1, i = 0;
-  
-  int output[20] = {0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0};
-  
-  while(i<=digit){
-    carry = 0;
-    if(i>=1) cur *= 10;
-    for(j=0; j<p->vrunIndex; j++)
-      carry += max[9-i];
-    if(i<9)
-      carry += (p->vruntime - ((p->vruntime / (cur * 10)) * cur * 10)) / cur;
-    else if(i==9) carry += p->vruntime / 1000000000;
-
-    carry += next;
-    output[i] = carry%10;
-    next = carry / 10;
-    i++;
-  }
+// Convert TSC cycles to the militicks ps reports.
+static uint64
+militicks(uint64 cycles)
+{
+  return divu64(cycles * 1000, tscpertick);
+}
 
-  //cprintf("%d\n", digit);
-  for(i=21-digit; i<=20; i++){
-    cprintf("%d", output[20 - i]);
-  }
+// Format n in decimal at the end of buf[21].
+static char*
+u64str(uint64 n, char *buf)
+{
+  char *s = buf + 20;
+  uint64 q;
+
+  *s = 0;
+  do {
+    q = divu64(n, 10);
+    *--s = '0' + (uint)(n - q*10);
+    n = q;
+  } while(n);
+  return s;
 }
 
 void padding2(int length, char* s){
@@ -822,8 +1162,31 @@ void padding2(int length, char* s){
   for(i=0; i<length - size; i++) cprintf(" ");
 }
 
+// Print per-cpu run queue counters, for ps -s.
+static void
+rqstat(void)
+{
+  struct cpu *c;
+  struct rq *rq;
+
+  cprintf("cpu       curpid    queued    load      migrations  steals\n");
+          //10       10        10        10        12
+  for(c = cpus; c < cpus+ncpu; c++){
+    rq = c->rq;
+    acquire(&rq->lock);
+    cprintf("%d", c - cpus); padding1(10, c - cpus);
+    cprintf("%d", c->proc ? c->proc->pid : 0); padding1(10, c->proc ? c->proc->pid : 0);
+    cprintf("%d", rq->nr_running); padding1(10, rq->nr_running);
+    cprintf("%d", rq->load); padding1(10, rq->load);
+    cprintf("%d", rq->nr_migrations); padding1(12, rq->nr_migrations);
+    cprintf("%d\n", rq->nr_steals);
+    release(&rq->lock);
+  }
+}
+
 void ps(int pid){
   struct proc *p;
+  char buf[21], *s;
   static char *states[] = {
   [UNUSED]    "UNUSED",
   [EMBRYO]    "EMBRYO",
@@ -833,270 +1196,804 @@ void ps(int pid){
   [ZOMBIE]    "ZOMBIE"
   };
 
+  if(pid == -2){
+    kmemstat();
+    return;
+  }
+  if(pid == -3){
+    slabstat();
+    return;
+  }
+  if(pid < 0){
+    rqstat();
+    return;
+  }
+
   acquire(&ptable.lock);
   cprintf("name      pid       state      priority       runtime/weight   runtime        vruntime            tick %d\n", ticks*1000);
           //10       10         11        15              17              15            20
-  if(pid == 0){
-    for(p = ptable.proc; p <= &ptable.proc[NPROC]; p++){
-      enum procstate pstate = p->state;
-      if(pstate >=1 && pstate <= 5 && p->vrunIndex==0){
-        cprintf("%s", p->name); padding2(10, p->name);
-        cprintf("%d", p->pid); padding1(10, p->pid);
-        cprintf("%s", states[pstate]); padding2(11, states[pstate]);
-        cprintf("%d", p->nice); padding1(15, p->nice);
-        cprintf("%d", p->runtime / p->weight); padding1(17, p->runtime / p->weight);
-        cprintf("%d", p->runtime); padding1(15, p->runtime);
-        cprintf("%d", p->vruntime); padding1(20, p->vruntime); cprintf("\n");
-      }
-      else if(pstate >=1 && pstate <=5 && p->vrunIndex!=0){
-        cprintf("%s", p->name); padding2(10, p->name);
-        cprintf("%d", p->pid); padding1(10, p->pid);
-        cprintf("%s", states[pstate]); padding2(11, states[pstate]);
-        cprintf("%d", p->nice); padding1(15, p->nice);
-        cprintf("%d", p->runtime / p->weight); padding1(17, p->runtime / p->weight);
-        cprintf("%d", p->runtime); padding1(15, p->runtime);
-        padding3(20, p); cprintf("\n");
+  for(p = pid ? findproc(pid) : ptable.all; p; p = pid ? 0 : p->allnext){
+    enum procstate pstate = p->state;
+    if(pstate == UNUSED)
+      continue;
+    cprintf("%s", p->name); padding2(10, p->name);
+    cprintf("%d", p->pid); padding1(10, p->pid);
+    cprintf("%s", states[pstate]); padding2(11, states[pstate]);
+    cprintf("%d", p->nice); padding1(15, p->nice);
+    s = u64str(divu64(militicks(p->runtime), p->weight), buf); cprintf("%s", s); padding2(17, s);
+    s = u64str(militicks(p->runtime), buf); cprintf("%s", s); padding2(15, s);
+    s = u64str(militicks(p->vruntime), buf); cprintf("%s\n", s);
+  }
+  release(&ptable.lock);
+}
+
+// Read the page of v's file at offset off into mem.
+static void
+vmaread(struct vma *v, char *mem, uint off)
+{
+  ilock(v->f->ip);
+  readi(v->f->ip, mem, off, PGSIZE);
+  iunlock(v->f->ip);
+}
+
+// Map the page cache page backing a in shared file
+// mapping v into pgdir.  Returns 1 if the page had to be
+// read from disk, 0 if it was cached, or -1 on failure.
+// Caller holds v->f->ip's lock.
+static int
+vmashare(pde_t *pgdir, struct vma *v, uint a)
+{
+  struct page *pg;
+  uint pgno;
+  int major;
+
+  pgno = (v->offset + (a - v->start)) / PGSIZE;
+  major = 0;
+  if((pg = pclookup(v->f->ip, pgno)) == 0){
+    if((pg = pcget(v->f->ip, pgno)) == 0)
+      return -1;
+    major = 1;
+  }
+  kref(pg->data);
+  if(mappages(pgdir, (void*)a, PGSIZE, V2P(pg->data), v->prot|PTE_U) < 0){
+    kfree(pg->data);
+    pcput(pg);
+    return -1;
+  }
+  pcput(pg);
+  return major;
+}
+
+// Map a zeroed 4MB page at a in MAP_HUGE region v of the
+// current process, whose pgdir is pgdir.  A page table left
+// empty in the slot by an earlier munmap is freed first.
+// Returns -1 if a page is mapped there already or there is
+// no contiguous 4MB of memory.
+static int
+vmahuge(pde_t *pgdir, struct vma *v, uint a)
+{
+  pde_t *pde;
+  pte_t *pgtab;
+  char *mem;
+  int i;
+
+  pde = &pgdir[PDX(a)];
+  if((*pde & (PTE_P|PTE_PS)) == PTE_P){
+    pgtab = (pte_t*)P2V(PTE_ADDR(*pde));
+    for(i = 0; i < NPTENTRIES; i++)
+      if(pgtab[i])
+        return -1;
+    *pde = 0;
+    lcr3(V2P(pgdir));
+    kfree((char*)pgtab);
+  }
+  if(*pde & PTE_P)
+    return -1;
+  if((mem = kalloc_order(HUGEORDER)) == 0)
+    return -1;
+  memset(mem, 0, HUGEPGSIZE);
+  *pde = V2P(mem) | v->prot | PTE_U | PTE_P | PTE_PS;
+  return 0;
+}
+
+// Write the pages of shared file mapping v in [start, end)
+// that were stored to since the last flush back to the
+// file, and clear the dirty bits of those written.  Returns
+// 0, or -1 if a write failed; its page stays dirty.  The
+// caller must reload pgdir if it is in use.
+static int
+vmaflush(pde_t *pgdir, struct vma *v, uint start, uint end)
+{
+  pte_t *pte;
+  uint a;
+  int r;
+
+  r = 0;
+  for(a = start; a < end; a += PGSIZE){
+    if((pte = walkpgdir(pgdir, (char*)a, 0)) == 0 ||
+       (*pte & (PTE_P|PTE_D)) != (PTE_P|PTE_D))
+      continue;
+    if(filewriteat(v->f, P2V(PTE_ADDR(*pte)), v->offset + (a - v->start), PGSIZE) < 0)
+      r = -1;
+    else
+      *pte &= ~PTE_D;
+  }
+  return r;
+}
+
+// Unmap and free v's pages in [start, end), writing
+// shared file pages back first.  A 4MB page only partly
+// in the range stays mapped.  The caller must reload
+// pgdir if it is in use.
+static void
+vmadrop(pde_t *pgdir, struct vma *v, uint start, uint end)
+{
+  pte_t *pte;
+  pde_t *pde;
+  uint a;
+
+  if(v->flags & MAP_HUGE){
+    for(a = HUGEROUNDUP(start); a + HUGEPGSIZE <= end; a += HUGEPGSIZE){
+      pde = &pgdir[PDX(a)];
+      if((*pde & (PTE_P|PTE_PS)) == (PTE_P|PTE_PS)){
+        kfree_order(P2V(PTE_ADDR(*pde)), HUGEORDER);
+        *pde = 0;
       }
     }
+    return;
   }
-  else{
-    for(p = ptable.proc; p <= &ptable.proc[NPROC]; p++){
-      enum procstate pstate = p->state;
-      if(p->pid == pid){
-        if(pstate >=1 && pstate <= 5 && p->vrunIndex==0){
-          cprintf("%s", p->name); padding2(10, p->name);
-          cprintf("%d", p->pid); padding1(10, p->pid);
-          cprintf("%s", states[pstate]); padding2(11, states[pstate]);
-          cprintf("%d", p->nice); padding1(15, p->nice);
-          cprintf("%d", p->runtime / p->weight); padding1(17, p->runtime / p->weight);
-          cprintf("%d", p->runtime); padding1(15, p->runtime);
-          cprintf("%d", p->vruntime); padding1(20, p->vruntime); cprintf("\n");
-        }
-        else if(pstate >=1 && pstate <=5 && p->vrunIndex!=0){
-          cprintf("%s", p->name); padding2(10, p->name);
-          cprintf("%d", p->pid); padding1(10, p->pid);
-          cprintf("%s", states[pstate]); padding2(11, states[pstate]);
-          cprintf("%d", p->nice); padding1(15, p->nice);
-          cprintf("%d", p->runtime / p->weight); padding1(17, p->runtime / p->weight);
-          cprintf("%d", p->runtime); padding1(15, p->runtime);
-          padding3(20, p); cprintf("\n");
-        }
-      }
+  if(v->f && (v->flags & MAP_SHARED))
+    vmaflush(pgdir, v, start, end);
+  for(a = start; a < end; a += PGSIZE){
+    if((pte = walkpgdir(pgdir, (char*)a, 0)) == 0)
+      continue;
+    if(*pte & PTE_P){
+      kfree(P2V(PTE_ADDR(*pte)));
+      *pte = 0;
+    } else if(*pte & PTE_SWAP){
+      swapfree(PTE_SLOT(*pte));
+      *pte = 0;
     }
   }
-  release(&ptable.lock);
 }
 
-uint mmap(uint addr, int length, int prot, int flags, int fd, int offset){
-  uint cur = 0;
-  struct proc *p = myproc();
+// Write back every shared file mapping of p.
+// Must not be called inside a file system transaction.
+void
+vmaflushall(struct proc *p)
+{
+  struct vma *v;
 
-  if(isFork!=0){
-    struct proc *temp;
-    acquire(&ptable.lock);
-    for(temp = ptable.proc; temp<= &ptable.proc[NPROC]; temp++){
-      if(temp->pid == isFork)
-        p = temp;
+  for(v = vmafirst(p); v; v = vmanext(v))
+    if(v->f && (v->flags & MAP_SHARED))
+      vmaflush(p->pgdir, v, v->start, v->end);
+}
+
+// Allocate and map every page of v in pgdir, filled from
+// the file if v maps one.
+static int
+vmapopulate(pde_t *pgdir, struct vma *v)
+{
+  uint a;
+  char *mem;
+  int r;
+
+  if(v->flags & MAP_HUGE){
+    for(a = v->start; a < v->end; a += HUGEPGSIZE)
+      if(vmahuge(pgdir, v, a) < 0)
+        return -1;
+    return 0;
+  }
+  for(a = v->start; a < v->end; a += PGSIZE){
+    if(v->f && (v->flags & MAP_SHARED)){
+      ilock(v->f->ip);
+      r = vmashare(pgdir, v, a);
+      iunlock(v->f->ip);
+      if(r < 0)
+        return -1;
+      continue;
+    }
+    if((mem = kalloc_reclaim(1)) == 0)
+      return -1;
+    if(v->f)
+      vmaread(v, mem, v->offset + (a - v->start));
+    if(mappages(pgdir, (void*)a, PGSIZE, V2P(mem), v->prot|PTE_U) < 0){
+      kfree(mem);
+      return -1;
     }
-    release(&ptable.lock);
   }
-  //cprintf("current passed pid: %d\n", p->pid);
+  return 0;
+}
+
+// Give np a copy of each of p's vmas, mapping the pages
+// p has in them to the same frames.  Pages of MAP_SHARED
+// regions stay shared; writable private ones become
+// copy-on-write in both, as in copyuvm.  Swapped out pages
+// share the swap slot, and 4MB pages are copied.  p must be
+// the current process.
+static int
+vmadup(struct proc *np, struct proc *p)
+{
+  struct vma *v, *nv;
+  pte_t *pte, *npte;
+  pde_t *pde;
+  uint a, pa;
+  char *mem;
+  int r;
+
+  r = -1;
+  for(v = vmafirst(p); v; v = vmanext(v)){
+    if((nv = vmaalloc()) == 0)
+      goto out;
+    nv->start = v->start;
+    nv->end = v->end;
+    nv->prot = v->prot;
+    nv->flags = v->flags;
+    nv->offset = v->offset;
+    nv->ranext = nv->raend = v->start;
+    nv->rasize = 0;
+    nv->advice = v->advice;
+    nv->f = v->f ? filedup(v->f) : 0;
+    vmainsert(np, nv);
+    if(v->flags & MAP_HUGE){
+      for(a = v->start; a < v->end; a += HUGEPGSIZE){
+        pde = &p->pgdir[PDX(a)];
+        if((*pde & (PTE_P|PTE_PS)) != (PTE_P|PTE_PS))
+          continue;
+        if((mem = kalloc_order(HUGEORDER)) == 0)
+          goto out;
+        memmove(mem, P2V(PTE_ADDR(*pde)), HUGEPGSIZE);
+        np->pgdir[PDX(a)] = V2P(mem) | PTE_FLAGS(*pde);
+      }
+      continue;
+    }
+    for(a = v->start; a < v->end; a += PGSIZE){
+      if((pte = walkpgdir(p->pgdir, (char*)a, 0)) == 0)
+        continue;
+      if(*pte & PTE_SWAP){
+        if((npte = walkpgdir(np->pgdir, (char*)a, 1)) == 0)
+          goto out;
+        swapdup(PTE_SLOT(*pte));
+        *npte = *pte;
+        continue;
+      }
+      if((*pte & PTE_P) == 0)
+        continue;
+      if((v->flags & MAP_SHARED) == 0 && (*pte & PTE_W))
+        *pte = (*pte & ~PTE_W) | PTE_COW;
+      pa = PTE_ADDR(*pte);
+      if(mappages(np->pgdir, (void*)a, PGSIZE, pa, PTE_FLAGS(*pte)) < 0)
+        goto out;
+      kref(P2V(pa));
+    }
+  }
+  r = 0;
+
+out:
+  lcr3(V2P(p->pgdir));  // flush p's stale writable TLB entries
+  return r;
+}
+
+// Map length bytes at MMAPBASE+addr, from fd at offset
+// unless flags has MAP_ANONYMOUS.  With MAP_POPULATE the
+// pages are mapped now, otherwise on first touch.
+// Returns the mapped address, or 0 on error.
+uint mmap(uint addr, int length, int prot, int flags, int fd, int offset){
+  struct proc *p = myproc();
   struct file *f = 0;
-  if(fd==-1) f = 0;
-  else f = p->ofile[fd];
-
-  addr += 0x40000000;
-  // pde_t *pgdir = p->pgdir;
-  // pde_t *pde;
-  // pde = &pgdir[PDX(addr)];
-  // *pde = (*pde & ~0xFFF) | ((prot|PTE_U) & 0xFFF);
-  //Turn on the page directory
-  //These four permission == 0x7
-  //cprintf("addr: %x prot: %d flags: %d fd: %d off: %d\n", addr, prot, flags, fd, offset);
-  if((fd<=0 && fd!=-1)||(fd>16))  return 0;
+  struct vma *v;
+
+  if(prot & ~(PROT_READ|PROT_WRITE)) return 0;
+  //prot goes straight into PTEs, so must not carry other PTE bits
+  if((fd<=0 && fd!=-1) || fd>=NOFILE) return 0;
+  if(fd != -1 && (f = p->ofile[fd]) == 0) return 0;
   if((flags & MAP_ANONYMOUS)==1 && (fd!=-1 || offset!=0)) {
     return 0;
   }
   if( (flags & MAP_ANONYMOUS) == 0 ){
+    if(f == 0 || f->type != FD_INODE) return 0;
     if((prot & PROT_READ) && !(f->readable)) return 0;
     if((prot & PROT_WRITE) && !(f->writable)) return 0;
-    if(f->type != FD_INODE) return 0;
+    if((flags & MAP_SHARED) && offset % PGSIZE) return 0;
+    //shared pages come straight from the page cache, so must line up with it
   }
-  //correctness check
-  
-  struct mmap_area* temp;
-  int i=0;
-  temp = &mma[0];
-  while(temp->valid!=-1) {
-    i++;
-    temp = &mma[i];
+  if(flags & MAP_HUGE){
+    if((flags & MAP_ANONYMOUS) == 0 || (flags & MAP_SHARED) || addr % HUGEPGSIZE)
+      return 0;
+    length = HUGEROUNDUP(length);
   }
-  
-  //find last empty space of mmap_area array
-  f = (f==0) ? 0 : filedup(f);
-  mma[i].proc = p;
-  mma[i].addr = addr;
-  mma[i].offset = offset;
-  mma[i].f = f;
-  mma[i].flags = flags;
-  mma[i].length = length;
-  mma[i].prot = prot;
-  mma[i].valid = 0;
-  //insert to last of mmap array
-  //valid 0 means there is no page table
-  
-  char *mem = 0;
-  if(flags == 0){//file-mapped and not populate
-    return addr;
-    //init addr(virtual mem)
-    //file will use at the page fault handler
+  //huge regions are anonymous, private and made of whole 4MB pages
+  if(addr % PGSIZE || length <= 0 || addr >= KERNBASE - MMAPBASE ||
+     length > KERNBASE - MMAPBASE - addr)
+    return 0;
+
+  if((v = vmaalloc()) == 0)
+    return 0;
+  v->start = MMAPBASE + addr;
+  v->end = v->start + length;
+  v->prot = prot;
+  v->flags = flags;
+  v->offset = offset;
+  v->ranext = v->raend = v->start;
+  v->rasize = 0;
+  v->advice = MADV_NORMAL;
+  p->vmbusy++;
+  if(vmainsert(p, v) < 0){
+    p->vmbusy--;
+    vmafree(v);
+    return 0;
   }
-  else if(flags == 1){//anonymous and not populate
+  v->f = f ? filedup(f) : 0;
 
-    return addr;
+  if((flags & MAP_POPULATE) && vmapopulate(p->pgdir, v) < 0){
+    munmap(v->start);
+    p->vmbusy--;
+    return 0;
   }
-  else if(flags == 2){//file-mapped and populate
-    f->off = offset;
-    //int r;
-    for(cur=0; cur<length; cur+=PGSIZE){
-      mem = kalloc();
-      //cprintf("%d\n",freememCount());
-      //cprintf("constructed %x\n", V2P(mem));
-      if(mem==0) return 0;
-      memset(mem, 0, PGSIZE);
-      //physical page allocate
-
-      fileread(f, mem, PGSIZE);
-      
-      //cprintf("%s\n", mem);
-      if(mappages(p->pgdir, (void*)(addr + cur), PGSIZE, V2P(mem), prot|PTE_U)==-1)
-        return 0;
-    //pte is created, new physical page and mmaped region is paired;
+  p->vmbusy--;
+  return v->start;
+}
+
+// Grow v's readahead window while faults walk it in order,
+// restart it on a jump, and start reading the file past
+// what earlier faults asked for.  a is the faulting page.
+// MADV_RANDOM turns readahead off and MADV_SEQUENTIAL
+// keeps the window at its largest.
+// Caller holds v->f->ip's lock.
+static void
+vmareadahead(struct vma *v, uint a)
+{
+  uint start, end;
+
+  if(v->advice == MADV_RANDOM)
+    return;
+  if(v->advice == MADV_SEQUENTIAL)
+    v->rasize = RAMAX;
+  else if(a != v->ranext){
+    v->rasize = 0;
+    v->raend = a + PGSIZE;
+    return;
+  } else if(v->rasize == 0)
+    v->rasize = 1;
+  else if(v->rasize < RAMAX)
+    v->rasize *= 2;
+
+  start = a + PGSIZE;
+  if(start < v->raend)
+    start = v->raend;
+  end = a + PGSIZE + v->rasize*PGSIZE;
+  if(end > v->end)
+    end = v->end;
+  if(start < end){
+    ireadahead(v->f->ip, v->offset + (start - v->start), end - start);
+    v->raend = end;
+  }
+}
+
+// Map up to FAULTAROUND pages of v from a on whose file
+// data is already cached, so touching them won't fault.
+// Returns the address after the last page mapped.
+// Caller holds v->f->ip's lock.
+static uint
+faultaround(pde_t *pgdir, struct vma *v, uint a)
+{
+  pte_t *pte;
+  char *mem;
+  int n;
+
+  if(v->advice == MADV_RANDOM)
+    return a;
+  for(n = 0; n < FAULTAROUND && a < v->end; n++, a += PGSIZE){
+    if((pte = walkpgdir(pgdir, (char*)a, 0)) != 0 && (*pte & (PTE_P|PTE_SWAP)))
+      break;
+    if((mem = kalloc_zeroed()) == 0)
+      break;
+    if(readicached(v->f->ip, mem, v->offset + (a - v->start), PGSIZE) < 0 ||
+       mappages(pgdir, (void*)a, PGSIZE, V2P(mem), v->prot|PTE_U) < 0){
+      kfree(mem);
+      break;
     }
-    mma[i].valid = 1;
   }
-  else if(flags == 3){//anonymous and populate
-    //cprintf("Fourth should pass here\n");
-    uint original = f->off;
-    f->off = offset;
-    //int r;
-    for(cur=0; cur<length; cur+=PGSIZE){
-      mem = kalloc();
-      //cprintf("%d\n",freememCount());
-      //cprintf("addr: %x\n", (uint)mem);
-      if(mem==0) return 0;
-      memset(mem, 0, PGSIZE);
-      //physical page allocate
-      
-      //cprintf("%s\n", mem);
-      if(mappages(p->pgdir, (void*)(addr + cur), PGSIZE, V2P(mem), prot|PTE_U)==-1)
+  return a;
+}
+
+// Lend the user page at page-aligned va to pipewrite()
+// instead of copying it: take a reference on the page and
+// make it copy-on-write, so that a later store by the
+// process gets it a new page and the lent one keeps what it
+// held.  Returns the page's kernel address, or 0 if it is
+// not mapped or is in a MAP_SHARED region, whose pages must
+// stay shared; copy it then.  kfree() ends the loan.
+char*
+pageloan(char *va)
+{
+  struct proc *p = myproc();
+  struct vma *v;
+  pte_t *pte;
+  char *pg;
+
+  if((v = vmafind(p, (uint)va)) != 0 && (v->flags & MAP_SHARED))
+    return 0;
+  if((pte = walkpgdir(p->pgdir, va, 0)) == 0 ||
+     (*pte & (PTE_P|PTE_U)) != (PTE_P|PTE_U))
+    return 0;
+  if(*pte & PTE_W){
+    *pte = (*pte & ~PTE_W) | PTE_COW;
+    lcr3(V2P(p->pgdir));
+  }
+  pg = P2V(PTE_ADDR(*pte));
+  kref(pg);
+  return pg;
+}
+
+// Make p see a change to its page table: reload %cr3 if p
+// is us, or else make p reload it when it next runs (see
+// switchuvm).
+static void
+pgchanged(struct proc *p)
+{
+  if(p == myproc())
+    lcr3(V2P(p->pgdir));
+  else
+    p->lastcpu = 0;
+}
+
+// Move the clock hand to the next page reclaim() may
+// evict, in a private, 4KB-page region of a process whose
+// page table we may change: our own, or one that is not
+// running, and in neither case in the middle of changing
+// its vmas or their PTEs (vmbusy).  Such a process cannot
+// start on that while we hold its run queue lock.  Returns that process with its run queue locked
+// in *rqp, its region in *vp and the page in *ap, or 0 once
+// the hand has passed the end of the process table three
+// times in this reclaim(), counted in *laps.
+// Caller holds ptable.lock.
+static struct proc*
+clockadvance(struct vma **vp, uint *ap, struct rq **rqp, int *laps)
+{
+  struct proc *p;
+  struct vma *v;
+  struct rq *rq;
+
+  for(p = clock.p; ; p = p->allnext, clock.va = 0){
+    if(p == 0){
+      if(++*laps == 3)
         return 0;
-    //pte is created, new physical page and mmaped region is paired;
+      p = ptable.all;
+    }
+    if(p->state == UNUSED || p->state == EMBRYO)
+      continue;
+    rq = task_rq_lock(p);
+    if((p == myproc() || p->state != RUNNING) && p->vmbusy == 0){
+      for(v = vmafirst(p); v; v = vmanext(v)){
+        if(v->end <= clock.va || (v->flags & (MAP_SHARED|MAP_HUGE)))
+          continue;
+        *ap = clock.va > v->start ? clock.va : v->start;
+        *vp = v;
+        *rqp = rq;
+        clock.p = p;
+        clock.va = *ap + PGSIZE;
+        return p;
+      }
     }
-    mma[i].valid = 1;
-    f->off = original;
+    release(&rq->lock);
   }
-
-  //Paired physical address and virtual address
-  return addr;
 }
 
-int page_fault_handler(uint addr, uint err){
-  struct proc *p = myproc();
-  int i;
-  
-  for(i=0; i<64; i++){
-    if( mma[i].addr <= addr && (addr < (mma[i].addr + mma[i].length)) && ( mma[i].proc == p ))
+// Evict up to n pages from processes' private mmap regions
+// to make free memory, sweeping a clock hand over them.  A
+// page touched since the hand last passed has its PTE_A bit
+// cleared and is passed over.  A clean page of a private
+// file mapping is dropped, since a fault reads it again.
+// An anonymous page is written to swap first, still mapped,
+// so its process may run meanwhile: PTE_D is cleared before
+// the write and the page is only unmapped if it is still
+// clean after.  Pages shared by fork() and written private
+// file pages stay.  Returns the number of pages freed.
+int
+reclaim(int n)
+{
+  struct proc *p;
+  struct vma *v;
+  struct rq *rq;
+  pde_t *pgdir;
+  pte_t *pte;
+  uint a, pa;
+  int freed, laps, pid, slot, done;
+
+  acquiresleep(&clock.lock);
+  freed = laps = 0;
+  while(freed < n){
+    acquire(&ptable.lock);
+    if((p = clockadvance(&v, &a, &rq, &laps)) == 0){
+      release(&ptable.lock);
       break;
+    }
+    if((pte = walkpgdir(p->pgdir, (char*)a, 0)) == 0)
+      clock.va = PGADDR(PDX(a) + 1, 0, 0);
+    if(pte == 0 || (*pte & PTE_P) == 0 ||
+       krefcount(P2V(PTE_ADDR(*pte))) != 1 || (v->f && (*pte & PTE_D))){
+      release(&rq->lock);
+      release(&ptable.lock);
+      continue;
+    }
+    if(*pte & PTE_A){
+      *pte &= ~PTE_A;
+      pgchanged(p);
+      release(&rq->lock);
+      release(&ptable.lock);
+      continue;
+    }
+    pa = PTE_ADDR(*pte);
+    if(v->f){
+      *pte = 0;
+      pgchanged(p);
+      release(&rq->lock);
+      release(&ptable.lock);
+      kfree(P2V(pa));
+      freed++;
+      continue;
+    }
+
+    // Hold the page across the write so that it is not
+    // recycled if p unmaps it meanwhile.
+    *pte &= ~PTE_D;
+    pgchanged(p);
+    kref(P2V(pa));
+    pid = p->pid;
+    pgdir = p->pgdir;
+    release(&rq->lock);
+    release(&ptable.lock);
+    if((slot = swapalloc()) < 0){
+      kfree(P2V(pa));
+      break;
+    }
+    swapout(P2V(pa), slot);
+
+    done = 0;
+    acquire(&ptable.lock);
+    rq = task_rq_lock(p);
+    if(p->pid == pid && p->pgdir == pgdir &&
+       (p == myproc() || p->state != RUNNING) && p->vmbusy == 0 &&
+       (pte = walkpgdir(pgdir, (char*)a, 0)) != 0 &&
+       PTE_ADDR(*pte) == pa && (*pte & (PTE_P|PTE_D)) == PTE_P &&
+       krefcount(P2V(pa)) == 2){
+      *pte = SWAPPTE(slot);
+      pgchanged(p);
+      done = 1;
+    }
+    release(&rq->lock);
+    release(&ptable.lock);
+    kfree(P2V(pa));
+    if(done){
+      kfree(P2V(pa));
+      freed++;
+    } else
+      swapfree(slot);
   }
-  if(i==64) return -1;
-  //there is no corresponding mmap_area
-  //cprintf("pfh passed: %d\n", err);
-  //cprintf("%d %d %x\n", mma[i].prot & PROT_WRITE, err, mma[i].valid);
+  releasesleep(&clock.lock);
+  return freed;
+}
+
+// Like kalloc(), or kalloc_zeroed() if zero is set, but
+// when memory has run out, evict pages with reclaim() and
+// try again.  May sleep.
+char*
+kalloc_reclaim(int zero)
+{
+  char *mem;
 
-  if((mma[i].prot & PROT_WRITE) != 2 && (err & 2) != 0) return -1;
-  //if((mma[i].prot & PROT_READ) == 1 && isWrite ==2 ) return -1;
+  while((mem = zero ? kalloc_zeroed() : kalloc()) == 0)
+    if(reclaim(RECLAIMBATCH) == 0)
+      break;
+  return mem;
+}
 
-  //cprintf("pfh passed\n");
-  //uint perm = mma[i].prot | PTE_U;
-  
-  //illegal mmap_area access
-  if(mma[i].valid==-1) {
-    cprintf("Illegal mmap access PASSED\n");
+// Map the page of an mmap region holding addr on first
+// touch.  Returns -1 if addr is not in a region or the
+// access is not allowed, and the process should die.
+int page_fault_handler(uint addr, uint err){
+  struct proc *p = myproc();
+  struct vma *v;
+  struct inode *ip = 0;
+  pte_t *pte;
+  char *mem;
+  uint a, off, slot;
+  int r;
+
+  if(p == 0 || (v = vmafind(p, addr)) == 0)
     return -1;
+  //there is no corresponding mmap region
+
+  if((v->prot & PROT_WRITE) == 0 && (err & 2) != 0) return -1;
+  //illegal mmap region access
+
+  if(v->flags & MAP_HUGE){
+    if(vmahuge(p->pgdir, v, HUGEROUNDDOWN(addr)) < 0)
+      return -1;
+    p->minflt++;
+    return 0;
   }
-  if(mma[i].valid == 1){
-    cprintf("Valid bit is already 1!\n");
+  //huge region maps a whole 4MB page at once
+
+  a = PGROUNDDOWN(addr);
+  if((pte = walkpgdir(p->pgdir, (char*)a, 0)) != 0 && (*pte & PTE_P))
     return -1;
-  }
+  //page is already mapped, so the access itself was bad
 
-  if(mma[i].valid==0){
-   // cprintf("IF PAGE FAULT OCCURED, SHOULD PASS HERE!\n");
-
-    struct file *f = mma[i].f;
-
-    //MUST ADD THIS!!
-    //only do all process for corresponding page
-
-    char *mem = 0;
-    f->off = mma[i].offset;
-    
-    mem = kalloc();
-    if(mem==0) return 0;
-    //physical page allocate
-    //cprintf("PFH addr: %x\nContent: %s\n", (uint)mem, mem);
-    memset(mem, 0, PGSIZE);
-    //annonymous and file mapping both initialize to 0
-    //readi(f->ip, mem, f->off, PGSIZE);
-    if((mma[i].flags & MAP_ANONYMOUS)==0)
-      fileread(f, mem, PGSIZE);
-    //if file mapping, read file
-    
-    if(mappages(p->pgdir, (void*)addr, PGSIZE, V2P(mem), mma[i].prot | PTE_W | PTE_U)==-1)
+  if(pte && (*pte & PTE_SWAP)){
+    if((mem = kalloc_reclaim(0)) == 0)
       return -1;
-    //page table entry is created, new physical page and mmaped region is paired;
-  
-    mma[i].valid = 1;
-    //valid (not page fault)
+    slot = PTE_SLOT(*pte);
+    swapin(mem, slot);
+    swapfree(slot);
+    *pte = V2P(mem) | v->prot | PTE_U | PTE_P;
+    p->majflt++;
+    return 0;
   }
-
+  //page was evicted by reclaim(), so read it back from swap
+
+  if(v->f && (v->flags & MAP_SHARED)){
+    ilock(v->f->ip);
+    if((r = vmashare(p->pgdir, v, a)) >= 0){
+      if(r)
+        p->majflt++;
+      else
+        p->minflt++;
+      vmareadahead(v, a);
+      v->ranext = a + PGSIZE;
+    }
+    iunlock(v->f->ip);
+    return r < 0 ? -1 : 0;
+  }
+  //shared file mapping maps the page cache page itself
+
+  mem = kalloc_reclaim(1);
+  if(mem==0) return -1;
+  //annonymous and file mapping both initialize to 0
+  if(v->f){
+    ip = v->f->ip;
+    off = v->offset + (a - v->start);
+    ilock(ip);
+    if(readicached(ip, mem, off, PGSIZE) >= 0)
+      p->minflt++;
+    else {
+      readi(ip, mem, off, PGSIZE);
+      p->majflt++;
+    }
+  } else
+    p->minflt++;
+  //if file mapping, read this page of the file, from the buffer cache if it is there
+
+  if(mappages(p->pgdir, (void*)a, PGSIZE, V2P(mem), v->prot | PTE_U)==-1){
+    kfree(mem);
+    if(ip)
+      iunlock(ip);
+    return -1;
+  }
+  if(ip){
+    vmareadahead(v, a);
+    v->ranext = faultaround(p->pgdir, v, a + PGSIZE);
+    iunlock(ip);
+  }
+  //start reading the pages a sequential reader wants next, and map the ones already cached
   return 0;
 }
 
+// Unmap the region mmap() returned at addr and free its
+// pages.  Returns 1, or -1 if there is no such region.
 int munmap(uint addr){
   struct proc *p = myproc();
-  int i;
+  struct vma *v;
+
+  if((v = vmafind(p, addr)) == 0 || v->start != addr)
+    return -1;
+
+  p->vmbusy++;
+  vmadrop(p->pgdir, v, v->start, v->end);
+  lcr3(V2P(p->pgdir));
+  vmaremove(p, v);
+  p->vmbusy--;
+  if(v->f)
+    fileclose(v->f);
+  vmafree(v);
+  return 1;
+}
 
-  for(i=0; i<64; i++)
-    if(mma[i].addr == addr && mma[i].proc == p) break;
-  if(i==64) return -1;
+// Write back the stores to shared file mapping pages in
+// [addr, addr+length) through the log.  flags is MS_SYNC
+// or MS_ASYNC; there is no background writeback, so both
+// write now.  Returns 0, or -1 if part of the range is not
+// mapped or a write fails.
+int msync(uint addr, int length, int flags){
+  struct proc *p = myproc();
+  struct vma *v;
+  uint a, end;
+  int r;
 
-  //there are no allocated physical pages
-  if(mma[i].valid == 0){
-    mma[i].valid = -1;
-    return 1;
+  if(length <= 0 || addr + length < addr)
+    return -1;
+  if((flags & ~(MS_ASYNC|MS_SYNC)) || flags == (MS_ASYNC|MS_SYNC))
+    return -1;
+
+  r = 0;
+  end = addr + length;
+  p->vmbusy++;
+  for(a = addr; a < end; a = v->end){
+    if((v = vmafind(p, a)) == 0){
+      r = -1;
+      break;
+    }
+    if(v->f && (v->flags & MAP_SHARED) &&
+       vmaflush(p->pgdir, v, PGROUNDDOWN(a), end < v->end ? end : v->end) < 0)
+      r = -1;
   }
+  lcr3(V2P(p->pgdir));
+  p->vmbusy--;
+  return r;
+}
 
-  //free allocated physical page and page table
-  uint cur = 0;
-  pte_t *pte;
+// Take advice about how [addr, addr+length) will be used.
+// MADV_NORMAL, MADV_RANDOM and MADV_SEQUENTIAL set the
+// readahead policy of each region the range touches.
+// MADV_WILLNEED starts reading the file in without waiting,
+// and MADV_DONTNEED frees the pages now; touching them again
+// refaults them from the file, or zeroed.  A 4MB page of a
+// MAP_HUGE region is only freed if the range covers it.  Returns 0, or -1
+// if advice is unknown or part of the range is not mapped.
+int madvise(uint addr, int length, int advice){
+  struct proc *p = myproc();
+  struct vma *v;
+  uint a, start, end;
 
-  //(char*)mmap(8192,8192,PROT_READ|PROT_WRITE,0,fd,0);
+  if(length <= 0 || addr + length < addr)
+    return -1;
+  if(advice < MADV_NORMAL || advice > MADV_DONTNEED)
+    return -1;
 
-  for( cur = 0; cur < mma[i].length; cur += PGSIZE){
-    pte = walkpgdir(p->pgdir, (char *)(addr+cur), 0);
-    if(pte==0) return -1;
-    if((*pte & PTE_P)==0) continue;
-    uint pa = PTE_ADDR(*pte) | ((addr+cur) & 0xFFF);
-    //cprintf("UNMAP addr: %x\n", pa);
-    //PTE_ADDR + VA_OFFSET = PA
-    kfree(P2V(pa));
-    *pte = 0; //reset page table entry
+  p->vmbusy++;
+  for(a = addr; a < addr + length; a = v->end){
+    if((v = vmafind(p, a)) == 0){
+      p->vmbusy--;
+      return -1;
+    }
+    start = PGROUNDDOWN(a);
+    end = addr + length < v->end ? addr + length : v->end;
+    switch(advice){
+    case MADV_NORMAL:
+    case MADV_RANDOM:
+    case MADV_SEQUENTIAL:
+      v->advice = advice;
+      v->rasize = 0;
+      break;
+    case MADV_WILLNEED:
+      if(v->f){
+        ilock(v->f->ip);
+        ireadahead(v->f->ip, v->offset + (start - v->start), end - start);
+        iunlock(v->f->ip);
+      }
+      break;
+    case MADV_DONTNEED:
+      // A shared anonymous page's data lives only in its
+      // mappings; leave it.
+      if(v->f || (v->flags & MAP_SHARED) == 0)
+        vmadrop(p->pgdir, v, start, end);
+      break;
+    }
   }
-  mma[i].valid = -1;
-  return 1;
+  lcr3(V2P(p->pgdir));
+  p->vmbusy--;
+  return 0;
 }
 
 int freemem(){
   return freememCount();
 }
+
+int swapins(){
+  return swapinCount();
+}
+
+int swapouts(){
+  return swapoutCount();
+}
@@ -8,18 +8,26 @@ struct cpu {
   int ncli;                    // Depth of pushcli nesting.
   int intena;                  // Were interrupts enabled before pushcli?
   struct proc *proc;           // The process running on this cpu or null
+  struct rq *rq;               // RUNNABLE processes queued on this cpu
+  uint64 nexttick;             // TSC value at which the next tick is due
+  volatile int need_resched;   // Set by wakeup to preempt proc
+  pde_t *volatile pgdir;       // Process page table in %cr3, or 0 for kpgdir
+  volatile int droppgdir;      // freevm() wants pgdir out of %cr3
 };
 
-struct mmap_area{
-  struct file *f;
-  uint addr;
-  int length;
-  int offset;
-  int prot;
-  int flags;
-  int valid;
-  
-  struct proc *proc;
+// A region of a process's address space made by mmap().
+struct vma {
+  uint start;                  // First address
+  uint end;                    // One past the last address
+  int prot;                    // PROT_READ, PROT_WRITE
+  int flags;                   // MAP_ANONYMOUS, MAP_POPULATE, MAP_SHARED, MAP_HUGE
+  struct file *f;              // Mapped file, or 0 if anonymous
+  uint offset;                 // File offset of start
+  uint ranext;                 // Page a sequential fault would hit next
+  uint rasize;                 // Readahead window, in pages
+  uint raend;                  // Readahead has been started up to here
+  int advice;                  // MADV_NORMAL, MADV_RANDOM, MADV_SEQUENTIAL
+  struct rb_node node;         // Link in proc's vmas, keyed on start
 };
 
 extern struct cpu cpus[NCPU];
@@ -55,23 +63,36 @@ struct proc {
   int pid;                     // Process ID
   int nice;
   uint weight;
-  uint progress;
+  uint64 exec_start;           // TSC when last charged by update_curr
 
   uint start;
   uint parse;
-  uint runtime;
-  uint vruntime;
-  uint vrunIndex;
-  uint allocated;
+  uint64 runtime;              // TSC cycles run in total
+  uint64 vruntime;             // Weighted runtime, CFS sort key
+  uint64 slice_end;            // TSC at which to preempt when RUNNING
+  struct rb_node rbnode;       // Link in cpu run queue, keyed on vruntime
+  int onrq;                    // If non-zero, queued on cpus[cpu].rq
+  int cpu;                     // Cpu whose run queue holds (or last ran) us
+  struct cpu *lastcpu;         // Cpu that last had pgdir in %cr3
 
   struct proc *parent;         // Parent process
   struct trapframe *tf;        // Trap frame for current syscall
   struct context *context;     // swtch() here to run process
   void *chan;                  // If non-zero, sleeping on chan
+  struct waitq *wq;            // If non-zero, queued on wq to sleep
+  struct proc *wqnext;         // Next sleeper on wq
   int killed;                  // If non-zero, have been killed
   struct file *ofile[NOFILE];  // Open files
   struct inode *cwd;           // Current directory
   char name[16];               // Process name (debugging)
+  struct rb_root vmas;         // mmap() regions, keyed on start
+  struct vma *vmacache;        // Last vma found by vmafind()
+  int vmbusy;                  // Changing vmas or their PTEs; reclaim() keeps out
+  uint minflt;                 // mmap faults served without I/O
+  uint majflt;                 // mmap faults that read the file
+  struct proc *allnext;        // Next slot in the process table
+  struct proc *hashnext;       // Next live proc in the same pid hash chain
+  struct proc *freenext;       // Next UNUSED slot on the free stack
 };
 
 // Process memory is laid out contiguously, low addresses first:
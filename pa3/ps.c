@@ -4,10 +4,13 @@
 
 int main(int argc, char *argv[]){
     int num;
-    if(argc==2) {
+    if(argc==2 && strcmp(argv[1], "-s")==0) ps(-1); // per-cpu run queue counters
+    else if(argc==2 && strcmp(argv[1], "-m")==0) ps(-2); // free memory by buddy order
+    else if(argc==2 && strcmp(argv[1], "-k")==0) ps(-3); // slab cache statistics
+    else if(argc==2) {
         num = atoi(argv[1]);
         ps(num);
     }
     else ps(0);
     exit();
-}
\ No newline at end of file
+}
@@ -0,0 +1,277 @@
+// Red-black tree rebalancing, after the classic
+// Linux lib/rbtree.c.  Callers do their own ordered
+// descent and use rb_link() to hang the new node.
+
+#include "types.h"
+#include "defs.h"
+#include "rbtree.h"
+
+static void
+rotate_left(struct rb_node *node, struct rb_root *root)
+{
+  struct rb_node *right = node->right;
+  struct rb_node *parent = node->parent;
+
+  if((node->right = right->left) != 0)
+    right->left->parent = node;
+  right->left = node;
+  right->parent = parent;
+  if(parent){
+    if(node == parent->left)
+      parent->left = right;
+    else
+      parent->right = right;
+  } else
+    root->node = right;
+  node->parent = right;
+}
+
+static void
+rotate_right(struct rb_node *node, struct rb_root *root)
+{
+  struct rb_node *left = node->left;
+  struct rb_node *parent = node->parent;
+
+  if((node->left = left->right) != 0)
+    left->right->parent = node;
+  left->right = node;
+  left->parent = parent;
+  if(parent){
+    if(node == parent->right)
+      parent->right = left;
+    else
+      parent->left = left;
+  } else
+    root->node = left;
+  node->parent = left;
+}
+
+static int
+isblack(struct rb_node *node)
+{
+  return node == 0 || node->color == RB_BLACK;
+}
+
+// Rebalance after node has been linked in with rb_link().
+void
+rb_insert(struct rb_node *node, struct rb_root *root)
+{
+  struct rb_node *parent, *gparent, *uncle, *tmp;
+
+  while((parent = node->parent) != 0 && parent->color == RB_RED){
+    gparent = parent->parent;
+    if(parent == gparent->left){
+      uncle = gparent->right;
+      if(uncle && uncle->color == RB_RED){
+        uncle->color = RB_BLACK;
+        parent->color = RB_BLACK;
+        gparent->color = RB_RED;
+        node = gparent;
+        continue;
+      }
+      if(parent->right == node){
+        rotate_left(parent, root);
+        tmp = parent;
+        parent = node;
+        node = tmp;
+      }
+      parent->color = RB_BLACK;
+      gparent->color = RB_RED;
+      rotate_right(gparent, root);
+    } else {
+      uncle = gparent->left;
+      if(uncle && uncle->color == RB_RED){
+        uncle->color = RB_BLACK;
+        parent->color = RB_BLACK;
+        gparent->color = RB_RED;
+        node = gparent;
+        continue;
+      }
+      if(parent->left == node){
+        rotate_right(parent, root);
+        tmp = parent;
+        parent = node;
+        node = tmp;
+      }
+      parent->color = RB_BLACK;
+      gparent->color = RB_RED;
+      rotate_left(gparent, root);
+    }
+  }
+  root->node->color = RB_BLACK;
+}
+
+static void
+erase_color(struct rb_node *node, struct rb_node *parent, struct rb_root *root)
+{
+  struct rb_node *other;
+
+  while(isblack(node) && node != root->node){
+    if(parent->left == node){
+      other = parent->right;
+      if(other->color == RB_RED){
+        other->color = RB_BLACK;
+        parent->color = RB_RED;
+        rotate_left(parent, root);
+        other = parent->right;
+      }
+      if(isblack(other->left) && isblack(other->right)){
+        other->color = RB_RED;
+        node = parent;
+        parent = node->parent;
+      } else {
+        if(isblack(other->right)){
+          other->left->color = RB_BLACK;
+          other->color = RB_RED;
+          rotate_right(other, root);
+          other = parent->right;
+        }
+        other->color = parent->color;
+        parent->color = RB_BLACK;
+        other->right->color = RB_BLACK;
+        rotate_left(parent, root);
+        node = root->node;
+        break;
+      }
+    } else {
+      other = parent->left;
+      if(other->color == RB_RED){
+        other->color = RB_BLACK;
+        parent->color = RB_RED;
+        rotate_right(parent, root);
+        other = parent->left;
+      }
+      if(isblack(other->left) && isblack(other->right)){
+        other->color = RB_RED;
+        node = parent;
+        parent = node->parent;
+      } else {
+        if(isblack(other->left)){
+          other->right->color = RB_BLACK;
+          other->color = RB_RED;
+          rotate_left(other, root);
+          other = parent->left;
+        }
+        other->color = parent->color;
+        parent->color = RB_BLACK;
+        other->left->color = RB_BLACK;
+        rotate_right(parent, root);
+        node = root->node;
+        break;
+      }
+    }
+  }
+  if(node)
+    node->color = RB_BLACK;
+}
+
+// Remove node from the tree.
+void
+rb_erase(struct rb_node *node, struct rb_root *root)
+{
+  struct rb_node *child, *parent, *old, *left;
+  int color;
+
+  if(node->left == 0)
+    child = node->right;
+  else if(node->right == 0)
+    child = node->left;
+  else {
+    // Two children: splice in the successor.
+    old = node;
+    node = node->right;
+    while((left = node->left) != 0)
+      node = left;
+
+    if(old->parent){
+      if(old->parent->left == old)
+        old->parent->left = node;
+      else
+        old->parent->right = node;
+    } else
+      root->node = node;
+
+    child = node->right;
+    parent = node->parent;
+    color = node->color;
+
+    if(parent == old)
+      parent = node;
+    else {
+      if(child)
+        child->parent = parent;
+      parent->left = child;
+      node->right = old->right;
+      old->right->parent = node;
+    }
+
+    node->parent = old->parent;
+    node->color = old->color;
+    node->left = old->left;
+    old->left->parent = node;
+    goto color;
+  }
+
+  parent = node->parent;
+  color = node->color;
+  if(child)
+    child->parent = parent;
+  if(parent){
+    if(parent->left == node)
+      parent->left = child;
+    else
+      parent->right = child;
+  } else
+    root->node = child;
+
+color:
+  if(color == RB_BLACK)
+    erase_color(child, parent, root);
+}
+
+// Smallest node in the tree, or 0 if empty.
+struct rb_node*
+rb_first(struct rb_root *root)
+{
+  struct rb_node *n;
+
+  if((n = root->node) == 0)
+    return 0;
+  while(n->left)
+    n = n->left;
+  return n;
+}
+
+// In-order successor of node, or 0.
+struct rb_node*
+rb_next(struct rb_node *node)
+{
+  struct rb_node *parent;
+
+  if(node->right){
+    node = node->right;
+    while(node->left)
+      node = node->left;
+    return node;
+  }
+  while((parent = node->parent) != 0 && node == parent->right)
+    node = parent;
+  return parent;
+}
+
+// In-order predecessor of node, or 0.
+struct rb_node*
+rb_prev(struct rb_node *node)
+{
+  struct rb_node *parent;
+
+  if(node->left){
+    node = node->left;
+    while(node->right)
+      node = node->right;
+    return node;
+  }
+  while((parent = node->parent) != 0 && node == parent->left)
+    node = parent;
+  return parent;
+}
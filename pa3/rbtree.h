@@ -0,0 +1,32 @@
+// Intrusive red-black trees.
+// Embed a struct rb_node in the object to be sorted and use
+// rb_entry() to get back from the node to the object.
+
+#define RB_RED    0
+#define RB_BLACK  1
+
+struct rb_node {
+  struct rb_node *parent;
+  struct rb_node *left;
+  struct rb_node *right;
+  int color;
+};
+
+struct rb_root {
+  struct rb_node *node;
+};
+
+#define rb_entry(ptr, type, member) \
+  ((type*)((char*)(ptr) - (uint)&((type*)0)->member))
+
+// Link node as a child of parent at *link, which the caller found
+// by walking down from the root.  Call rb_insert() afterwards to
+// rebalance.
+static inline void
+rb_link(struct rb_node *node, struct rb_node *parent, struct rb_node **link)
+{
+  node->parent = parent;
+  node->left = node->right = 0;
+  node->color = RB_RED;
+  *link = node;
+}
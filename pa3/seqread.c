@@ -0,0 +1,53 @@
+// Sequential read benchmark.
+// Read each file named on the command line (or _usertests)
+// from start to end, and report how many sectors the disk
+// moved per interrupt while doing it.
+
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+#include "fcntl.h"
+
+char buf[4096];
+
+void
+seqread(char *path)
+{
+  int fd, n, tot, t0;
+  uint before[2], after[2], nintr, nsect;
+
+  if((fd = open(path, O_RDONLY)) < 0){
+    printf(1, "seqread: cannot open %s\n", path);
+    return;
+  }
+  iostat(before);
+  t0 = uptime();
+  tot = 0;
+  while((n = read(fd, buf, sizeof(buf))) > 0)
+    tot += n;
+  t0 = uptime() - t0;
+  iostat(after);
+  close(fd);
+
+  nintr = after[0] - before[0];
+  nsect = after[1] - before[1];
+  if(nintr == 0){
+    printf(1, "seqread: %s: %d bytes, all cached\n", path, tot);
+    return;
+  }
+  printf(1, "seqread: %s: %d bytes in %d ticks, %d sectors, "
+         "%d interrupts, %d sectors per interrupt\n",
+         path, tot, t0, nsect, nintr, nsect / nintr);
+}
+
+int
+main(int argc, char *argv[])
+{
+  int i;
+
+  if(argc < 2)
+    seqread("_usertests");
+  for(i = 1; i < argc; i++)
+    seqread(argv[i]);
+  exit();
+}
@@ -0,0 +1,160 @@
+// Slab allocator for fixed-size kernel objects.
+//
+// Each slabcache carves whole pages from kalloc() into
+// objects of one size.  Each cpu keeps a magazine of free
+// objects and only takes the cache's lock to move
+// SLABBATCH objects between its magazine and the cache's
+// free list, as kalloc() does with pages.  Pages stay with
+// their cache once carved; freed objects are reused.
+//
+// Interface:
+// * slabinit() sets up a statically allocated cache.
+// * slaballoc() returns a zeroed object, or 0.
+// * slabfree() gives it back.
+
+#include "types.h"
+#include "defs.h"
+#include "param.h"
+#include "mmu.h"
+#include "spinlock.h"
+#include "slab.h"
+
+#define SLABBATCH  8   // objects moved between a magazine and the cache
+#define SLABMAG   16   // most objects a magazine holds
+
+// All caches.  They are set up during boot, before the
+// other cpus start, so the list needs no lock.
+static struct slabcache *slabs;
+
+void
+slabinit(struct slabcache *c, char *name, uint size)
+{
+  if(size < sizeof(void*))
+    size = sizeof(void*);
+  size = (size + sizeof(void*) - 1) & ~(sizeof(void*) - 1);
+  if(size > PGSIZE)
+    panic("slabinit");
+
+  memset(c, 0, sizeof(*c));
+  c->name = name;
+  c->size = size;
+  initlock(&c->lock, name);
+  c->next = slabs;
+  slabs = c;
+}
+
+// Move up to SLABBATCH objects from c's free list to m,
+// carving a new page first if the list is empty.
+static void
+slabfill(struct slabcache *c, struct slabmag *m)
+{
+  char *mem, *o;
+  int n;
+
+  acquire(&c->lock);
+  if(c->free == 0 && (mem = kalloc()) != 0){
+    c->npages++;
+    for(o = mem; o + c->size <= mem + PGSIZE; o += c->size){
+      *(void**)o = c->free;
+      c->free = o;
+    }
+  }
+  for(n = 0; n < SLABBATCH && c->free; n++){
+    o = c->free;
+    c->free = *(void**)o;
+    *(void**)o = m->free;
+    m->free = o;
+    m->n++;
+  }
+  release(&c->lock);
+}
+
+// Move SLABBATCH objects from m back to c's free list.
+static void
+slabdrain(struct slabcache *c, struct slabmag *m)
+{
+  void *o;
+  int n;
+
+  acquire(&c->lock);
+  for(n = 0; n < SLABBATCH && m->free; n++){
+    o = m->free;
+    m->free = *(void**)o;
+    m->n--;
+    *(void**)o = c->free;
+    c->free = o;
+  }
+  release(&c->lock);
+}
+
+// Allocate a zeroed object from c.
+// Returns 0 if the memory cannot be allocated.
+void*
+slaballoc(struct slabcache *c)
+{
+  struct slabmag *m;
+  void *o;
+
+  pushcli();
+  m = &c->mag[cpuid()];
+  m->nalloc++;
+  if(m->free)
+    m->nhit++;
+  else
+    slabfill(c, m);
+  if((o = m->free) != 0){
+    m->free = *(void**)o;
+    m->n--;
+  }
+  popcli();
+
+  if(o)
+    memset(o, 0, c->size);
+  return o;
+}
+
+// Return object o to c.
+void
+slabfree(struct slabcache *c, void *o)
+{
+  struct slabmag *m;
+
+  pushcli();
+  m = &c->mag[cpuid()];
+  *(void**)o = m->free;
+  m->free = o;
+  m->n++;
+  if(m->n >= SLABMAG)
+    slabdrain(c, m);
+  popcli();
+}
+
+// Print each cache's objects in use, memory footprint and
+// magazine hit rate, for ps -k.  The counts are read
+// without locks, so they may be slightly off.
+void
+slabstat(void)
+{
+  struct slabcache *c;
+  uint nalloc, nhit, nfree, total;
+  void *o;
+  int i;
+
+  cprintf("cache     size   inuse  total  pages  allocs  hit%%\n");
+  for(c = slabs; c; c = c->next){
+    nalloc = nhit = nfree = 0;
+    for(i = 0; i < NCPU; i++){
+      nalloc += c->mag[i].nalloc;
+      nhit += c->mag[i].nhit;
+      nfree += c->mag[i].n;
+    }
+    acquire(&c->lock);
+    for(o = c->free; o; o = *(void**)o)
+      nfree++;
+    release(&c->lock);
+    total = c->npages * (PGSIZE / c->size);
+    cprintf("%s\t  %d\t %d\t%d\t%d\t%d\t%d\n", c->name, c->size,
+            total - nfree, total, c->npages, nalloc,
+            nalloc ? nhit * 100 / nalloc : 0);
+  }
+}
@@ -0,0 +1,19 @@
+// Per-cpu cache of free objects.
+struct slabmag {
+  void *free;                  // linked through each object's first word
+  int n;
+  uint nalloc;                 // allocations on this cpu
+  uint nhit;                   // of those, served from free
+};
+
+// Cache of fixed-size kernel objects, carved from pages.
+struct slabcache {
+  char *name;
+  uint size;                   // object size
+  struct spinlock lock;
+  void *free;                  // free objects not in a magazine
+  uint npages;                 // pages carved into objects
+  struct slabmag mag[NCPU];
+  struct slabcache *next;      // all caches, for slabstat()
+};
+
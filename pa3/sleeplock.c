@@ -6,14 +6,17 @@
 #include "x86.h"
 #include "memlayout.h"
 #include "mmu.h"
+#include "rbtree.h"
 #include "proc.h"
 #include "spinlock.h"
+#include "waitq.h"
 #include "sleeplock.h"
 
 void
 initsleeplock(struct sleeplock *lk, char *name)
 {
   initlock(&lk->lk, "sleep lock");
+  initwaitq(&lk->wait);
   lk->name = name;
   lk->locked = 0;
   lk->pid = 0;
@@ -24,7 +27,7 @@ acquiresleep(struct sleeplock *lk)
 {
   acquire(&lk->lk);
   while (lk->locked) {
-    sleep(lk, &lk->lk);
+    sleepq(&lk->wait, &lk->lk);
   }
   lk->locked = 1;
   lk->pid = myproc()->pid;
@@ -37,7 +40,7 @@ releasesleep(struct sleeplock *lk)
   acquire(&lk->lk);
   lk->locked = 0;
   lk->pid = 0;
-  wakeup(lk);
+  wakeupq(&lk->wait);
   release(&lk->lk);
 }
 
@@ -2,6 +2,7 @@
 struct sleeplock {
   uint locked;       // Is the lock held?
   struct spinlock lk; // spinlock protecting this sleep lock
+  struct waitq wait;  // processes waiting for the lock
   
   // For debugging:
   char *name;        // Name of lock.
@@ -0,0 +1,150 @@
+// Swap space.
+//
+// mkfs leaves sb.nswap pages' worth of blocks after the file
+// system.  reclaim() (see proc.c) writes anonymous pages it
+// evicts to a free slot there and leaves the slot number in
+// the page table entry, marked PTE_SWAP, until a fault reads
+// the page back.  fork() shares a swapped page between
+// parent and child the way it shares a mapped one, so each
+// slot counts the page table entries that refer to it.
+//
+// Swap I/O bypasses the buffer cache, so that evicting pages
+// does not also push file blocks out of it.
+
+#include "types.h"
+#include "defs.h"
+#include "param.h"
+#include "mmu.h"
+#include "spinlock.h"
+#include "waitq.h"
+#include "sleeplock.h"
+#include "fs.h"
+#include "buf.h"
+
+struct {
+  struct spinlock lock;
+  int dev;
+  uint start;          // First swap block
+  uint nslot;          // Number of slots, at most NSWAP
+  uint next;           // Slot swapalloc looks at first
+  ushort ref[NSWAP];   // Page table entries holding each slot
+  uint nin;            // Pages read back in
+  uint nout;           // Pages written out
+} swap;
+
+// The one buffer swap I/O goes through; its lock
+// serializes swapping.
+static struct buf swapbuf;
+
+void
+swapinit(int dev)
+{
+  struct superblock sb;
+
+  initlock(&swap.lock, "swap");
+  initsleeplock(&swapbuf.lock, "swap");
+  initwaitq(&swapbuf.wait);
+  readsb(dev, &sb);
+  swap.dev = dev;
+  swap.start = sb.swapstart;
+  swap.nslot = sb.nswap < NSWAP ? sb.nswap : NSWAP;
+}
+
+// Allocate a swap slot.  Returns its number, or -1 if swap
+// is full.
+int
+swapalloc(void)
+{
+  uint i, s;
+
+  acquire(&swap.lock);
+  for(i = 0; i < swap.nslot; i++){
+    s = (swap.next + i) % swap.nslot;
+    if(swap.ref[s] == 0){
+      swap.ref[s] = 1;
+      swap.next = s + 1;
+      release(&swap.lock);
+      return s;
+    }
+  }
+  release(&swap.lock);
+  return -1;
+}
+
+// Note another page table entry holding slot.
+void
+swapdup(uint slot)
+{
+  acquire(&swap.lock);
+  if(slot >= swap.nslot || swap.ref[slot] == 0)
+    panic("swapdup");
+  swap.ref[slot]++;
+  release(&swap.lock);
+}
+
+// Drop a page table entry's hold on slot, freeing it
+// with the last.
+void
+swapfree(uint slot)
+{
+  acquire(&swap.lock);
+  if(slot >= swap.nslot || swap.ref[slot] == 0)
+    panic("swapfree");
+  swap.ref[slot]--;
+  release(&swap.lock);
+}
+
+// Move the page at pg to or from slot, one block at a time.
+static void
+swaprw(char *pg, uint slot, int write)
+{
+  int i;
+
+  acquiresleep(&swapbuf.lock);
+  for(i = 0; i < SWAPPGBLOCKS; i++){
+    swapbuf.dev = swap.dev;
+    swapbuf.blockno = swap.start + slot*SWAPPGBLOCKS + i;
+    if(write){
+      memmove(swapbuf.data, pg + i*BSIZE, BSIZE);
+      swapbuf.flags = B_DIRTY;
+      iderw(&swapbuf);
+    } else {
+      swapbuf.flags = 0;
+      iderw(&swapbuf);
+      memmove(pg + i*BSIZE, swapbuf.data, BSIZE);
+    }
+  }
+  releasesleep(&swapbuf.lock);
+}
+
+// Write the page at pg to slot.
+void
+swapout(char *pg, uint slot)
+{
+  swaprw(pg, slot, 1);
+  acquire(&swap.lock);
+  swap.nout++;
+  release(&swap.lock);
+}
+
+// Read slot into the page at pg.
+void
+swapin(char *pg, uint slot)
+{
+  swaprw(pg, slot, 0);
+  acquire(&swap.lock);
+  swap.nin++;
+  release(&swap.lock);
+}
+
+int
+swapinCount(void)
+{
+  return swap.nin;
+}
+
+int
+swapoutCount(void)
+{
+  return swap.nout;
+}
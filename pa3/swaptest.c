@@ -0,0 +1,41 @@
+// Swap test.
+// Write to more anonymous memory than is free, so that the
+// kernel has to swap some of it out, then check that every
+// page reads back what was written to it.
+
+#include "param.h"
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+
+#define EXTRA  1024   // pages past free memory
+
+int
+main(void)
+{
+  int n, i, ins, outs;
+  char *a;
+
+  n = freemem() + EXTRA;
+  ins = swapins();
+  outs = swapouts();
+  a = (char*)mmap(0, n*4096, PROT_READ|PROT_WRITE, MAP_ANONYMOUS, -1, 0);
+  if(a == 0){
+    printf(1, "swaptest: mmap failed\n");
+    exit();
+  }
+  for(i = 0; i < n; i++){
+    *(int*)(a + i*4096) = i;
+    *(int*)(a + i*4096 + 4092) = ~i;
+  }
+  for(i = 0; i < n; i++){
+    if(*(int*)(a + i*4096) != i || *(int*)(a + i*4096 + 4092) != ~i){
+      printf(1, "swaptest: page %d is wrong\n", i);
+      exit();
+    }
+  }
+  munmap((uint)a);
+  printf(1, "swaptest: %d pages ok, %d swapped out, %d swapped in\n",
+         n, swapouts() - outs, swapins() - ins);
+  exit();
+}
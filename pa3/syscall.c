@@ -3,6 +3,7 @@
 #include "param.h"
 #include "memlayout.h"
 #include "mmu.h"
+#include "rbtree.h"
 #include "proc.h"
 #include "x86.h"
 #include "syscall.h"
@@ -109,6 +110,12 @@ extern int sys_ps(void);
 extern int sys_mmap(void);
 extern int sys_munmap(void);
 extern int sys_freemem(void);
+extern int sys_getfaults(void);
+extern int sys_msync(void);
+extern int sys_madvise(void);
+extern int sys_swapins(void);
+extern int sys_swapouts(void);
+extern int sys_iostat(void);
 
 static int (*syscalls[])(void) = {
 [SYS_fork]    sys_fork,
@@ -138,6 +145,12 @@ static int (*syscalls[])(void) = {
 [SYS_mmap] sys_mmap,
 [SYS_munmap] sys_munmap,
 [SYS_freemem] sys_freemem,
+[SYS_getfaults] sys_getfaults,
+[SYS_msync] sys_msync,
+[SYS_madvise] sys_madvise,
+[SYS_swapins] sys_swapins,
+[SYS_swapouts] sys_swapouts,
+[SYS_iostat] sys_iostat,
 };
 
 void
@@ -25,4 +25,10 @@
 #define SYS_ps 24
 #define SYS_mmap   25
 #define SYS_munmap 26
-#define SYS_freemem 27
\ No newline at end of file
+#define SYS_freemem 27
+#define SYS_getfaults 28
+#define SYS_msync 29
+#define SYS_madvise 30
+#define SYS_swapins 31
+#define SYS_swapouts 32
+#define SYS_iostat 33
\ No newline at end of file
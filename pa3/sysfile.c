@@ -9,9 +9,11 @@
 #include "param.h"
 #include "stat.h"
 #include "mmu.h"
+#include "rbtree.h"
 #include "proc.h"
 #include "fs.h"
 #include "spinlock.h"
+#include "waitq.h"
 #include "sleeplock.h"
 #include "file.h"
 #include "fcntl.h"
@@ -5,6 +5,7 @@
 #include "param.h"
 #include "memlayout.h"
 #include "mmu.h"
+#include "rbtree.h"
 #include "proc.h"
 
 int
@@ -140,4 +141,56 @@ sys_munmap(void){
 int
 sys_freemem(void){
   return freemem();
-}
\ No newline at end of file
+}
+
+int
+sys_getfaults(void)
+{
+  int pid;
+  uint *counts;
+
+  if(argint(0, &pid) < 0 || argptr(1, (void*)&counts, 2*sizeof(uint)) < 0)
+    return -1;
+  return getfaults(pid, counts);
+}
+
+int
+sys_msync(void)
+{
+  int addr, length, flags;
+
+  if(argint(0, &addr) < 0 || argint(1, &length) < 0 || argint(2, &flags) < 0)
+    return -1;
+  return msync(addr, length, flags);
+}
+
+int
+sys_madvise(void)
+{
+  int addr, length, advice;
+
+  if(argint(0, &addr) < 0 || argint(1, &length) < 0 || argint(2, &advice) < 0)
+    return -1;
+  return madvise(addr, length, advice);
+}
+
+int
+sys_swapins(void){
+  return swapins();
+}
+
+int
+sys_swapouts(void){
+  return swapouts();
+}
+
+int
+sys_iostat(void)
+{
+  uint *counts;
+
+  if(argptr(0, (void*)&counts, 2*sizeof(uint)) < 0)
+    return -1;
+  iostat(counts);
+  return 0;
+}
@@ -0,0 +1,43 @@
+// TLB reach benchmark.
+// Touch one word in every 4KB of an 8MB anonymous mapping,
+// over and over, first with 4KB pages and then with 4MB
+// MAP_HUGE pages, and report how long each took.  The
+// 4KB run needs 2048 TLB entries to cover the region, the
+// huge one needs 2.
+
+#include "param.h"
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+
+#define LEN     (8*1024*1024)
+#define PASSES  200
+
+int
+stride(uint addr, int flags)
+{
+  int i, j, start;
+  volatile int *a;
+
+  a = (volatile int*)mmap(addr, LEN, PROT_READ|PROT_WRITE,
+                          MAP_ANONYMOUS|MAP_POPULATE|flags, -1, 0);
+  if(a == 0){
+    printf(1, "tlbbench: mmap failed\n");
+    exit();
+  }
+  start = uptime();
+  for(i = 0; i < PASSES; i++)
+    for(j = 0; j < LEN/4; j += 4096/4)
+      a[j + (i & 63)]++;
+  start = uptime() - start;
+  munmap((uint)a);
+  return start;
+}
+
+int
+main(void)
+{
+  printf(1, "tlbbench: 4KB pages %d ticks\n", stride(0, 0));
+  printf(1, "tlbbench: 4MB pages %d ticks\n", stride(LEN, MAP_HUGE));
+  exit();
+}
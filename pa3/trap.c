@@ -3,6 +3,7 @@
 #include "param.h"
 #include "memlayout.h"
 #include "mmu.h"
+#include "rbtree.h"
 #include "proc.h"
 #include "x86.h"
 #include "traps.h"
@@ -32,10 +33,28 @@ idtinit(void)
   lidt(idt, sizeof(idt));
 }
 
+// Arm this cpu's one-shot timer for its next tick or the end
+// of the running process's slice, whichever comes first.
+// Must be called with interrupts disabled.
+void
+timerarm(void)
+{
+  struct cpu *c = mycpu();
+  uint64 now = rdtsc();
+  uint64 deadline = c->nexttick;
+
+  if(c->proc && c->proc->slice_end < deadline)
+    deadline = c->proc->slice_end;
+  lapiconeshot(deadline > now ? deadline - now : 0);
+}
+
 //PAGEBREAK: 41
 void
 trap(struct trapframe *tf)
 {
+  uint64 now;
+  uint n;
+
   if(tf->trapno == T_SYSCALL){
     if(myproc()->killed)
       exit();
@@ -43,17 +62,32 @@ trap(struct trapframe *tf)
     syscall();
     if(myproc()->killed)
       exit();
+    if(needresched())
+      yield();
     return;
   }
 
   switch(tf->trapno){
   case T_IRQ0 + IRQ_TIMER:
-    if(cpuid() == 0){
+    // The one-shot timer may fire for a slice end between
+    // ticks, or late; count however many ticks have passed.
+    now = rdtsc();
+    n = 0;
+    while(now >= mycpu()->nexttick){
+      mycpu()->nexttick += tscpertick;
+      n++;
+    }
+    if(cpuid() == 0 && n > 0){
       acquire(&tickslock);
-      ticks++;
+      ticks += n;
       wakeup(&ticks);
       release(&tickslock);
     }
+    timerarm();
+    lapiceoi();
+    break;
+  case T_IRQ0 + IRQ_RESCHED:
+    // Sent by wakeup on another cpu; need_resched is set.
     lapiceoi();
     break;
   case T_IRQ0 + IRQ_IDE:
@@ -79,6 +113,10 @@ trap(struct trapframe *tf)
     break;
   case T_PGFLT:
    // cprintf("PAGE FAULT\n");
+    // A write to a page fork() left shared: copy it now.
+    // The kernel faults here too when it writes user memory.
+    if(myproc() && (tf->err & 2) && cowfault(myproc()->pgdir, rcr2()) == 0)
+      break;
     if(page_fault_handler(rcr2(), tf->err)!=-1)
       break;
   //PAGEBREAK: 13
@@ -103,13 +141,13 @@ trap(struct trapframe *tf)
   if(myproc() && myproc()->killed && (tf->cs&3) == DPL_USER)
     exit();
 
-  // Force process to give up CPU on clock tick.
+  // Force process to give up CPU at the end of its slice,
+  // or early if a wakeup set need_resched on this cpu.
   // If interrupts were on while locks held, would need to check nlock.
-  if(myproc() && myproc()->state == RUNNING && tf->trapno == T_IRQ0+IRQ_TIMER){
-    myproc()->progress += 1000;
-    if(myproc()->progress >= myproc()->allocated)
-      yield();
-  }
+  if(myproc() && myproc()->state == RUNNING &&
+     (needresched() ||
+      (tf->trapno == T_IRQ0+IRQ_TIMER && rdtsc() >= myproc()->slice_end)))
+    yield();
 
   // Check if the process has been killed since we yielded
   if(myproc() && myproc()->killed && (tf->cs&3) == DPL_USER)
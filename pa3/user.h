@@ -29,6 +29,12 @@ void ps(int);
 uint mmap(uint, int, int, int, int, int);
 int munmap(uint);
 uint freemem(void);
+int getfaults(int, uint*);
+int msync(uint, int, int);
+int madvise(uint, int, int);
+int swapins(void);
+int swapouts(void);
+int iostat(uint*);
 
 // ulib.c
 int stat(const char*, struct stat*);
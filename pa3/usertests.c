@@ -424,6 +424,317 @@ exitwait(void)
   printf(1, "exitwait ok\n");
 }
 
+// map a file without MAP_POPULATE, touch three of its
+// pages, and check that each came from its own offset
+// and cost one fault.
+void
+mmapfaults(void)
+{
+  enum { NPAGE = 8 };
+  int fd, i;
+  uint before[2], after[2];
+  char *a;
+
+  printf(1, "mmapfaults test\n");
+  fd = open("mmapfaults", O_CREATE|O_RDWR);
+  if(fd < 0){
+    printf(1, "create mmapfaults failed\n");
+    exit();
+  }
+  for(i = 0; i < NPAGE; i++){
+    memset(buf, 'a' + i, 4096);
+    if(write(fd, buf, 4096) != 4096){
+      printf(1, "write mmapfaults failed\n");
+      exit();
+    }
+  }
+  close(fd);
+
+  fd = open("mmapfaults", O_RDONLY);
+  getfaults(getpid(), before);
+  a = (char*)mmap(0, NPAGE*4096, PROT_READ, 0, fd, 0);
+  if(a == 0){
+    printf(1, "mmap mmapfaults failed\n");
+    exit();
+  }
+  if(a[0] != 'a' || a[5*4096] != 'f' || a[7*4096+100] != 'h'){
+    printf(1, "mmapfaults: wrong data\n");
+    exit();
+  }
+  getfaults(getpid(), after);
+  // cached pages may be mapped ahead of a fault, so
+  // touching 3 pages costs at most 3 faults.
+  i = (after[0] - before[0]) + (after[1] - before[1]);
+  if(i < 1 || i > 3){
+    printf(1, "mmapfaults: %d faults for 3 pages\n", i);
+    exit();
+  }
+  munmap((uint)a);
+  close(fd);
+  unlink("mmapfaults");
+  printf(1, "mmapfaults ok\n");
+}
+
+// a child's stores to a MAP_SHARED file mapping must show
+// up in the parent's mapping, in read(), and in the file
+// once unmapped.
+void
+mmapshared(void)
+{
+  int fd, pid;
+  char *a;
+
+  printf(1, "mmapshared test\n");
+  fd = open("mmapshared", O_CREATE|O_RDWR);
+  if(fd < 0){
+    printf(1, "create mmapshared failed\n");
+    exit();
+  }
+  memset(buf, 'a', 4096);
+  if(write(fd, buf, 4096) != 4096 || write(fd, buf, 4096) != 4096){
+    printf(1, "write mmapshared failed\n");
+    exit();
+  }
+  a = (char*)mmap(0, 2*4096, PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0);
+  if(a == 0){
+    printf(1, "mmap mmapshared failed\n");
+    exit();
+  }
+  if(a[4096] != 'a'){
+    printf(1, "mmapshared: wrong data\n");
+    exit();
+  }
+
+  pid = fork();
+  if(pid < 0){
+    printf(1, "fork failed\n");
+    exit();
+  }
+  if(pid == 0){
+    a[0] = 'X';
+    a[4096+1] = 'Y';
+    exit();
+  }
+  wait();
+  if(a[0] != 'X' || a[4096+1] != 'Y'){
+    printf(1, "mmapshared: child store not visible\n");
+    exit();
+  }
+  close(fd);
+
+  fd = open("mmapshared", O_RDONLY);
+  if(read(fd, buf, 4096) != 4096 || buf[0] != 'X'){
+    printf(1, "mmapshared: read() missed the store\n");
+    exit();
+  }
+  close(fd);
+  if(munmap((uint)a) != 1){
+    printf(1, "munmap mmapshared failed\n");
+    exit();
+  }
+
+  fd = open("mmapshared", O_RDONLY);
+  if(read(fd, buf, 2*4096) != 2*4096 || buf[0] != 'X' || buf[4096+1] != 'Y'){
+    printf(1, "mmapshared: store not written back\n");
+    exit();
+  }
+  close(fd);
+  unlink("mmapshared");
+  printf(1, "mmapshared ok\n");
+}
+
+// madvise(MADV_DONTNEED) drops stores to private pages,
+// so they refault from the file or zeroed, but keeps a 4MB
+// page it covers only part of; msync() checks its flags.
+void
+madvisetest(void)
+{
+  int fd;
+  char *a, *b, *h;
+
+  printf(1, "madvise test\n");
+  fd = open("madvise", O_CREATE|O_RDWR);
+  if(fd < 0){
+    printf(1, "create madvise failed\n");
+    exit();
+  }
+  memset(buf, 'a', 4096);
+  if(write(fd, buf, 4096) != 4096){
+    printf(1, "write madvise failed\n");
+    exit();
+  }
+  a = (char*)mmap(0, 4096, PROT_READ|PROT_WRITE, 0, fd, 0);
+  b = (char*)mmap(4096, 4096, PROT_READ|PROT_WRITE, MAP_ANONYMOUS, -1, 0);
+  if(a == 0 || b == 0){
+    printf(1, "mmap madvise failed\n");
+    exit();
+  }
+  a[0] = 'X';
+  b[0] = 'X';
+  if(madvise((uint)a, 4096, MADV_WILLNEED) != 0 ||
+     madvise((uint)a, 2*4096, MADV_DONTNEED) != 0){
+    printf(1, "madvise failed\n");
+    exit();
+  }
+  if(a[0] != 'a' || b[0] != 0){
+    printf(1, "madvise: MADV_DONTNEED kept the stores\n");
+    exit();
+  }
+  h = (char*)mmap(4<<20, 4<<20, PROT_READ|PROT_WRITE, MAP_ANONYMOUS|MAP_HUGE, -1, 0);
+  if(h == 0){
+    printf(1, "mmap madvise failed\n");
+    exit();
+  }
+  h[4096] = 'X';
+  if(madvise((uint)h, 4096, MADV_DONTNEED) != 0 || h[4096] != 'X'){
+    printf(1, "madvise: MADV_DONTNEED dropped a huge page\n");
+    exit();
+  }
+  munmap((uint)h);
+  if(madvise((uint)a, 4096, 99) != -1 ||
+     msync((uint)a, 4096, MS_SYNC|MS_ASYNC) != -1 ||
+     msync((uint)a, 4096, MS_SYNC) != 0){
+    printf(1, "madvise: bad arguments not rejected\n");
+    exit();
+  }
+  munmap((uint)a);
+  munmap((uint)b);
+  close(fd);
+  unlink("madvise");
+  printf(1, "madvise ok\n");
+}
+
+// fork with a populated 1MB private mapping: children
+// write to it and must not disturb the parent's copy.
+// Reports how long the forks took.
+void
+mmapfork(void)
+{
+  enum { N = 200, LEN = 1024*1024 };
+  int i, pid, start;
+  char *a;
+
+  printf(1, "mmapfork test\n");
+  a = (char*)mmap(0, LEN, PROT_READ|PROT_WRITE, MAP_ANONYMOUS|MAP_POPULATE, -1, 0);
+  if(a == 0){
+    printf(1, "mmap mmapfork failed\n");
+    exit();
+  }
+  for(i = 0; i < LEN; i += 4096)
+    a[i] = 'p';
+
+  start = uptime();
+  for(i = 0; i < N; i++){
+    pid = fork();
+    if(pid < 0){
+      printf(1, "fork failed\n");
+      exit();
+    }
+    if(pid == 0){
+      a[(i % (LEN/4096)) * 4096] = 'c';
+      exit();
+    }
+    wait();
+  }
+
+  for(i = 0; i < LEN; i += 4096){
+    if(a[i] != 'p'){
+      printf(1, "mmapfork: child write reached parent\n");
+      exit();
+    }
+  }
+  munmap((uint)a);
+  printf(1, "mmapfork ok: %d forks in %d ticks\n", N, uptime() - start);
+}
+
+// keep 1000 children alive at once, blocked on a pipe,
+// then reap them all, and report how long that took.
+void
+manyprocs(void)
+{
+  enum { N = 1000 };
+  int i, n, fds[2], start;
+  char c;
+
+  printf(1, "manyprocs test\n");
+  if(pipe(fds) != 0){
+    printf(1, "pipe() failed\n");
+    exit();
+  }
+  start = uptime();
+  for(n = 0; n < N; n++){
+    int pid = fork();
+    if(pid < 0)
+      break;
+    if(pid == 0){
+      close(fds[1]);
+      read(fds[0], &c, 1);
+      exit();
+    }
+  }
+  close(fds[0]);
+  close(fds[1]);
+  for(i = 0; i < n; i++){
+    if(wait() < 0){
+      printf(1, "manyprocs: wait stopped early\n");
+      exit();
+    }
+  }
+  if(n < N){
+    printf(1, "manyprocs: fork failed after %d procs\n", n);
+    exit();
+  }
+  printf(1, "manyprocs ok: %d procs in %d ticks\n", N, uptime() - start);
+}
+
+// fork a process with a 1MB heap over and over, each child
+// writing one page and exiting, and report forks per second.
+// Compare with a kernel built with make NOCOW=1, whose fork
+// copies the whole heap.
+void
+forkbench(void)
+{
+  enum { N = 500, HEAP = 1024*1024 };
+  int i, pid, start, t;
+  char *heap;
+
+  printf(1, "forkbench test\n");
+  heap = sbrk(HEAP);
+  if(heap == (char*)-1){
+    printf(1, "forkbench: sbrk failed\n");
+    exit();
+  }
+  for(i = 0; i < HEAP; i += 4096)
+    heap[i] = 'p';
+
+  start = uptime();
+  for(i = 0; i < N; i++){
+    pid = fork();
+    if(pid < 0){
+      printf(1, "forkbench: fork failed\n");
+      exit();
+    }
+    if(pid == 0){
+      heap[(i % (HEAP/4096)) * 4096] = 'c';
+      exit();
+    }
+    wait();
+  }
+  t = uptime() - start;
+
+  for(i = 0; i < HEAP; i += 4096){
+    if(heap[i] != 'p'){
+      printf(1, "forkbench: child write reached parent\n");
+      exit();
+    }
+  }
+  sbrk(-HEAP);
+  if(t == 0)
+    t = 1;
+  printf(1, "forkbench ok: %d forks in %d ticks, %d forks/sec\n",
+         N, t, N*100/t);
+}
+
 void
 mem(void)
 {
@@ -1383,7 +1694,7 @@ forktest(void)
 
   printf(1, "fork test\n");
 
-  for(n=0; n<1000; n++){
+  for(n=0; n<10000; n++){
     pid = fork();
     if(pid < 0)
       break;
@@ -1391,8 +1702,8 @@ forktest(void)
       exit();
   }
 
-  if(n == 1000){
-    printf(1, "fork claimed to work 1000 times!\n");
+  if(n == 10000){
+    printf(1, "fork claimed to work 10000 times!\n");
     exit();
   }
 
@@ -1783,6 +2094,12 @@ main(int argc, char *argv[])
   pipe1();
   preempt();
   exitwait();
+  manyprocs();
+  mmapfaults();
+  mmapshared();
+  madvisetest();
+  mmapfork();
+  forkbench();
 
   rmdot();
   fourteen();
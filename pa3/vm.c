@@ -4,12 +4,24 @@
 #include "x86.h"
 #include "memlayout.h"
 #include "mmu.h"
+#include "rbtree.h"
 #include "proc.h"
+#include "spinlock.h"
 #include "elf.h"
 
 extern char data[];  // defined by kernel.ld
 pde_t *kpgdir;  // for use in scheduler()
 
+// Page tables freevm() found still loaded on another cpu,
+// left for freevmdeferred() to free once they are dropped.
+// Each is loaded on a different cpu, so NCPU slots do.
+static struct {
+  struct spinlock lock;
+  pde_t *pgdir[NCPU];
+} deadvm;
+
+static void vmfree(pde_t*);
+
 // Set up CPU's kernel segment descriptors.
 // Run once on entry on each CPU.
 void
@@ -40,12 +52,13 @@ walkpgdir(pde_t *pgdir, const void *va, int alloc)
 
   pde = &pgdir[PDX(va)];
   if(*pde & PTE_P){
+    if(*pde & PTE_PS)
+      return 0;  // a 4MB page has no page table
     pgtab = (pte_t*)P2V(PTE_ADDR(*pde));
   } else {
-    if(!alloc || (pgtab = (pte_t*)kalloc()) == 0)
-      return 0;
     // Make sure all those PTE_P bits are zero.
-    memset(pgtab, 0, PGSIZE);
+    if(!alloc || (pgtab = (pte_t*)kalloc_zeroed()) == 0)
+      return 0;
     // The permissions here are overly generous, but they can
     // be further restricted by the permissions in the page table
     // entries, if necessary.
@@ -114,6 +127,31 @@ static struct kmap {
  { (void*)DEVSPACE, DEVSPACE,      0,         PTE_W}, // more devices
 };
 
+// Like mappages, but map each 4MB-aligned stretch of at
+// least 4MB with a single PTE_PS directory entry instead
+// of a page table, and mark everything PTE_G: the kernel
+// half is the same in every page table, so its TLB entries
+// can survive %cr3 loads.  va, pa and size must be
+// page-aligned.
+static int
+mapkernel(pde_t *pgdir, void *va, uint size, uint pa, int perm)
+{
+  uint a, n;
+
+  a = (uint)va;
+  for(; size > 0; a += n, pa += n, size -= n){
+    if(a % HUGEPGSIZE == 0 && pa % HUGEPGSIZE == 0 && size >= HUGEPGSIZE){
+      pgdir[PDX(a)] = pa | perm | PTE_P | PTE_PS | PTE_G;
+      n = HUGEPGSIZE;
+    } else {
+      if(mappages(pgdir, (void*)a, PGSIZE, pa, perm | PTE_G) < 0)
+        return -1;
+      n = PGSIZE;
+    }
+  }
+  return 0;
+}
+
 // Set up kernel part of a page table.
 pde_t*
 setupkvm(void)
@@ -121,14 +159,20 @@ setupkvm(void)
   pde_t *pgdir;
   struct kmap *k;
 
-  if((pgdir = (pde_t*)kalloc()) == 0)
+  if((pgdir = (pde_t*)kalloc_zeroed()) == 0)
     return 0;
-  memset(pgdir, 0, PGSIZE);
+  // Once kpgdir is built, share its kernel page tables
+  // rather than building a private copy for every process.
+  if(kpgdir){
+    memmove(&pgdir[PDX(KERNBASE)], &kpgdir[PDX(KERNBASE)],
+            (NPDENTRIES - PDX(KERNBASE)) * sizeof(pde_t));
+    return pgdir;
+  }
   if (P2V(PHYSTOP) > (void*)DEVSPACE)
     panic("PHYSTOP too high");
   for(k = kmap; k < &kmap[NELEM(kmap)]; k++)
-    if(mappages(pgdir, k->virt, k->phys_end - k->phys_start,
-                (uint)k->phys_start, k->perm) < 0) {
+    if(mapkernel(pgdir, k->virt, k->phys_end - k->phys_start,
+                 (uint)k->phys_start, k->perm) < 0) {
       freevm(pgdir);
       return 0;
     }
@@ -140,6 +184,7 @@ setupkvm(void)
 void
 kvmalloc(void)
 {
+  initlock(&deadvm.lock, "deadvm");
   kpgdir = setupkvm();
   switchkvm();
 }
@@ -153,9 +198,16 @@ switchkvm(void)
 }
 
 // Switch TSS and h/w page table to correspond to process p.
+// Skip the %cr3 load if p's page table is still loaded from
+// the last time p ran on this cpu; p changes its own
+// mappings only while running and flushes the TLB of the cpu
+// it is on, so nothing here is stale.  A process that ran
+// elsewhere in between gets a fresh load.
 void
 switchuvm(struct proc *p)
 {
+  struct cpu *c;
+
   if(p == 0)
     panic("switchuvm: no process");
   if(p->kstack == 0)
@@ -173,7 +225,12 @@ switchuvm(struct proc *p)
   // forbids I/O instructions (e.g., inb and outb) from user space
   mycpu()->ts.iomb = (ushort) 0xFFFF;
   ltr(SEG_TSS << 3);
-  lcr3(V2P(p->pgdir));  // switch to process's address space
+  c = mycpu();
+  if(c->pgdir != p->pgdir || p->lastcpu != c){
+    lcr3(V2P(p->pgdir));  // switch to process's address space
+    c->pgdir = p->pgdir;
+  }
+  p->lastcpu = c;
   popcli();
 }
 
@@ -231,13 +288,12 @@ allocuvm(pde_t *pgdir, uint oldsz, uint newsz)
 
   a = PGROUNDUP(oldsz);
   for(; a < newsz; a += PGSIZE){
-    mem = kalloc();
+    mem = kalloc_reclaim(1);
     if(mem == 0){
       cprintf("allocuvm out of memory\n");
       deallocuvm(pgdir, newsz, oldsz);
       return 0;
     }
-    memset(mem, 0, PGSIZE);
     if(mappages(pgdir, (char*)a, PGSIZE, V2P(mem), PTE_W|PTE_U) < 0){
       cprintf("allocuvm out of memory (2)\n");
       deallocuvm(pgdir, newsz, oldsz);
@@ -273,23 +329,90 @@ deallocuvm(pde_t *pgdir, uint oldsz, uint newsz)
       char *v = P2V(pa);
       kfree(v);
       *pte = 0;
+    } else if(*pte & PTE_SWAP){
+      swapfree(PTE_SLOT(*pte));
+      *pte = 0;
     }
   }
   return newsz;
 }
 
+// Return whether some cpu still has pgdir loaded, asking
+// each such cpu to drop it when it next goes idle.
+static int
+vmloaded(pde_t *pgdir)
+{
+  struct cpu *c;
+  int r;
+
+  r = 0;
+  for(c = cpus; c < cpus+ncpu; c++){
+    if(c->pgdir == pgdir){
+      c->droppgdir = 1;
+      r = 1;
+    }
+  }
+  return r;
+}
+
+// Free the page tables on deadvm that no cpu has loaded
+// any more.  Called by the scheduler after dropping one.
+void
+freevmdeferred(void)
+{
+  pde_t *pgdir;
+  int i;
+
+  acquire(&deadvm.lock);
+  for(i = 0; i < NCPU; i++){
+    if((pgdir = deadvm.pgdir[i]) != 0 && !vmloaded(pgdir)){
+      deadvm.pgdir[i] = 0;
+      vmfree(pgdir);
+    }
+  }
+  release(&deadvm.lock);
+}
+
 // Free a page table and all the physical memory pages
-// in the user part.
+// in the user part.  An idle cpu may still have pgdir
+// loaded from a process that last ran there (see
+// scheduler); then it is freed once that cpu drops it,
+// rather than waiting for it here.
 void
 freevm(pde_t *pgdir)
 {
-  uint i;
+  int i;
 
   if(pgdir == 0)
     panic("freevm: no pgdir");
+  freevmdeferred();
+  acquire(&deadvm.lock);
+  if(vmloaded(pgdir)){
+    for(i = 0; i < NCPU && deadvm.pgdir[i]; i++)
+      ;
+    if(i == NCPU)
+      panic("freevm: deadvm full");
+    deadvm.pgdir[i] = pgdir;
+    pgdir = 0;
+  }
+  release(&deadvm.lock);
+  if(pgdir)
+    vmfree(pgdir);
+}
+
+// Free pgdir, which no cpu has loaded, and all the physical
+// memory pages in its user part, 4MB pages included.  The
+// kernel part's page tables are shared with kpgdir and stay.
+static void
+vmfree(pde_t *pgdir)
+{
+  uint i;
+
   deallocuvm(pgdir, KERNBASE, 0);
-  for(i = 0; i < NPDENTRIES; i++){
-    if(pgdir[i] & PTE_P){
+  for(i = 0; i < PDX(KERNBASE); i++){
+    if((pgdir[i] & (PTE_P|PTE_PS)) == (PTE_P|PTE_PS))
+      kfree_order(P2V(PTE_ADDR(pgdir[i])), HUGEORDER);
+    else if(pgdir[i] & PTE_P){
       char * v = P2V(PTE_ADDR(pgdir[i]));
       kfree(v);
     }
@@ -311,14 +434,16 @@ clearpteu(pde_t *pgdir, char *uva)
 }
 
 // Given a parent process's page table, create a copy
-// of it for a child.
+// of it for a child.  The two share every page; writable
+// ones become read-only and PTE_COW in both, and the first
+// write copies them (see cowfault).  pgdir must be the
+// current page table.
 pde_t*
 copyuvm(pde_t *pgdir, uint sz)
 {
   pde_t *d;
   pte_t *pte;
   uint pa, i, flags;
-  char *mem;
 
   if((d = setupkvm()) == 0)
     return 0;
@@ -327,23 +452,66 @@ copyuvm(pde_t *pgdir, uint sz)
       panic("copyuvm: pte should exist");
     if(!(*pte & PTE_P))
       panic("copyuvm: page not present");
+    if(*pte & PTE_W)
+      *pte = (*pte & ~PTE_W) | PTE_COW;
     pa = PTE_ADDR(*pte);
     flags = PTE_FLAGS(*pte);
-    if((mem = kalloc()) == 0)
-      goto bad;
-    memmove(mem, (char*)P2V(pa), PGSIZE);
-    if(mappages(d, (void*)i, PGSIZE, V2P(mem), flags) < 0) {
-      kfree(mem);
+    if(mappages(d, (void*)i, PGSIZE, pa, flags) < 0)
       goto bad;
-    }
+    kref((char*)P2V(pa));
   }
+  lcr3(V2P(pgdir));  // flush the parent's stale writable TLB entries
   return d;
 
 bad:
+  lcr3(V2P(pgdir));
   freevm(d);
   return 0;
 }
 
+// Handle a write to the page holding va in pgdir: if it is
+// shared copy-on-write, give pgdir a private writable copy,
+// or take the page back outright if no one else maps it.
+// Returns -1 if va is not a copy-on-write page or there is
+// no memory for the copy.  pgdir must be the current page
+// table.
+int
+cowfault(pde_t *pgdir, uint va)
+{
+  pte_t *pte;
+  uint pa, flags;
+  char *mem;
+
+  if(va >= KERNBASE || (pte = walkpgdir(pgdir, (void*)va, 0)) == 0)
+    return -1;
+  if((*pte & (PTE_P|PTE_COW)) != (PTE_P|PTE_COW))
+    return -1;
+  pa = PTE_ADDR(*pte);
+  flags = (PTE_FLAGS(*pte) | PTE_W) & ~PTE_COW;
+  if(krefcount((char*)P2V(pa)) == 1)
+    *pte = pa | flags;
+  else {
+    // Hold the page while allocating, so that reclaim()
+    // cannot take it if the other sharers let go meanwhile.
+    // A kernel store made while holding a spinlock must not
+    // sleep in reclaim(); it gets only what is free.
+    kref((char*)P2V(pa));
+    mem = mycpu()->ncli > 0 ? kalloc() : kalloc_reclaim(0);
+    if(mem == 0){
+      kfree((char*)P2V(pa));
+      return -1;
+    }
+    memmove(mem, (char*)P2V(pa), PGSIZE);
+    *pte = V2P(mem) | flags;
+    kfree((char*)P2V(pa));
+    kfree((char*)P2V(pa));
+  }
+  lcr3(V2P(pgdir));
+  return 0;
+}
+
+// Like copyuvm, but give the child its own copy of every
+// page now.  fork uses it when built with -DNOCOW.
 pde_t*
 copypage(pde_t *pgdir, uint sz)
 {
@@ -361,7 +529,7 @@ copypage(pde_t *pgdir, uint sz)
       panic("copyuvm: page not present");
     pa = PTE_ADDR(*pte);
     flags = PTE_FLAGS(*pte);
-    if((mem = kalloc()) == 0)
+    if((mem = kalloc_reclaim(0)) == 0)
       goto bad;
     memmove(mem, (char*)P2V(pa), PGSIZE);
     if(mappages(d, (void*)i, PGSIZE, V2P(mem), flags) < 0) {
@@ -0,0 +1,126 @@
+// Virtual memory areas made by mmap().
+// Each process keeps its vmas in a red-black tree keyed on
+// start address, plus a pointer to the last one found, since
+// faults tend to hit the same area repeatedly.  vmas never
+// overlap.  Only the owning process looks at its tree, so it
+// needs no lock.  vmas come from a slab cache.
+
+#include "types.h"
+#include "defs.h"
+#include "param.h"
+#include "mmu.h"
+#include "rbtree.h"
+#include "proc.h"
+#include "spinlock.h"
+#include "slab.h"
+
+static struct slabcache vmaslab;
+
+void
+vmainit(void)
+{
+  slabinit(&vmaslab, "vma", sizeof(struct vma));
+}
+
+// Allocate a zeroed vma.  Returns 0 if out of memory.
+struct vma*
+vmaalloc(void)
+{
+  return slaballoc(&vmaslab);
+}
+
+void
+vmafree(struct vma *v)
+{
+  slabfree(&vmaslab, v);
+}
+
+// Return p's vma containing addr, or 0.
+struct vma*
+vmafind(struct proc *p, uint addr)
+{
+  struct rb_node *n;
+  struct vma *v;
+
+  v = p->vmacache;
+  if(v && v->start <= addr && addr < v->end)
+    return v;
+  n = p->vmas.node;
+  while(n){
+    v = rb_entry(n, struct vma, node);
+    if(addr < v->start)
+      n = n->left;
+    else if(addr >= v->end)
+      n = n->right;
+    else {
+      p->vmacache = v;
+      return v;
+    }
+  }
+  return 0;
+}
+
+// Add v to p's tree.  Returns -1 if it overlaps a vma
+// already there.
+int
+vmainsert(struct proc *p, struct vma *v)
+{
+  struct rb_node **link = &p->vmas.node, *parent = 0;
+  struct vma *w;
+
+  while(*link){
+    parent = *link;
+    w = rb_entry(parent, struct vma, node);
+    if(v->end <= w->start)
+      link = &parent->left;
+    else if(v->start >= w->end)
+      link = &parent->right;
+    else
+      return -1;
+  }
+  rb_link(&v->node, parent, link);
+  rb_insert(&v->node, &p->vmas);
+  return 0;
+}
+
+// Take v out of p's tree.  The caller frees it.
+void
+vmaremove(struct proc *p, struct vma *v)
+{
+  rb_erase(&v->node, &p->vmas);
+  if(p->vmacache == v)
+    p->vmacache = 0;
+}
+
+// p's lowest vma, or 0.
+struct vma*
+vmafirst(struct proc *p)
+{
+  struct rb_node *n = rb_first(&p->vmas);
+
+  return n ? rb_entry(n, struct vma, node) : 0;
+}
+
+// The vma above v, or 0.
+struct vma*
+vmanext(struct vma *v)
+{
+  struct rb_node *n = rb_next(&v->node);
+
+  return n ? rb_entry(n, struct vma, node) : 0;
+}
+
+// Drop all of p's vmas.  The pages they mapped belong to
+// p's page table and are freed with it.
+void
+vmafreeall(struct proc *p)
+{
+  struct vma *v;
+
+  while((v = vmafirst(p)) != 0){
+    vmaremove(p, v);
+    if(v->f)
+      fileclose(v->f);
+    vmafree(v);
+  }
+}
@@ -0,0 +1,7 @@
+// Queue of processes sleeping until some condition holds.
+// Objects embed one per condition and use sleepq()/wakeupq();
+// sleep()/wakeup() on any other channel use a hashed bucket.
+struct waitq {
+  struct spinlock lock;  // protects the list
+  struct proc *head;     // sleepers, linked by proc->wqnext
+};
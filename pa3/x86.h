@@ -9,6 +9,15 @@ inb(ushort port)
   return data;
 }
 
+static inline uint
+inl(ushort port)
+{
+  uint data;
+
+  asm volatile("in %1,%0" : "=a" (data) : "d" (port));
+  return data;
+}
+
 static inline void
 insl(int port, void *addr, int cnt)
 {
@@ -30,6 +39,12 @@ outw(ushort port, ushort data)
   asm volatile("out %0,%1" : : "a" (data), "d" (port));
 }
 
+static inline void
+outl(ushort port, uint data)
+{
+  asm volatile("out %0,%1" : : "a" (data), "d" (port));
+}
+
 static inline void
 outsl(int port, const void *addr, int cnt)
 {
@@ -130,6 +145,17 @@ xchg(volatile uint *addr, uint newval)
   return result;
 }
 
+// Atomically add v to *addr and return the old value.
+static inline int
+xadd(volatile int *addr, int v)
+{
+  asm volatile("lock; xaddl %0, %1" :
+               "+r" (v), "+m" (*addr) :
+               :
+               "cc", "memory");
+  return v;
+}
+
 static inline uint
 rcr2(void)
 {
@@ -144,6 +170,30 @@ lcr3(uint val)
   asm volatile("movl %0,%%cr3" : : "r" (val));
 }
 
+// Read the time-stamp counter.
+static inline uint64
+rdtsc(void)
+{
+  uint lo, hi;
+
+  asm volatile("rdtsc" : "=a" (lo), "=d" (hi));
+  return ((uint64)hi << 32) | lo;
+}
+
+// Divide 64-bit n by 32-bit d.  The kernel is not linked
+// with libgcc, so split the division into two divl's, each
+// of which fits because the high half's remainder is below d.
+static inline uint64
+divu64(uint64 n, uint d)
+{
+  uint hi = n >> 32, lo = n, qhi, qlo, r;
+
+  qhi = hi / d;
+  r = hi % d;
+  asm("divl %4" : "=a" (qlo), "=d" (r) : "a" (lo), "1" (r), "rm" (d));
+  return ((uint64)qhi << 32) | qlo;
+}
+
 //PAGEBREAK: 36
 // Layout of the trap frame built on the stack by the
 // hardware and by trapasm.S, and passed to trap().